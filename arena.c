@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#include "arena.h"
+#include "tile.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static uint64_t arena_round(uint64_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(uint64_t)(ARENA_ALIGN - 1);
+}
+
+static void slot_begin(struct arena_slot *slot) {
+  __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void slot_end(struct arena_slot *slot) {
+  __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* readers map the arena as it was when they started, so it only grows */
+static bool arena_grow(struct arena *arena, size_t size) {
+  if (ftruncate(arena->fd, size) < 0)
+    return false;
+
+  void *data = arena->header
+                   ? mremap(arena->header, arena->size, size, MREMAP_MAYMOVE)
+                   : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          arena->fd, 0);
+  if (data == MAP_FAILED)
+    return false;
+
+  arena->header = data;
+  arena->size = size;
+  arena->header->size = size;
+  return true;
+}
+
+/* the bytes are punched out at once, so a slot still pointing at them must
+ * be repointed between slot_begin and slot_end first; a reader would
+ * otherwise take the zeroed pages for a snapshot */
+static void arena_free(struct arena *arena, uint64_t offset, uint64_t size) {
+  if (!size)
+    return;
+
+  fallocate(arena->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+            size);
+
+  int i = 0;
+  while (i < arena->free_count && arena->free[i].offset < offset)
+    i++;
+
+  bool merge_prev = i > 0 && arena->free[i - 1].offset +
+                                     arena->free[i - 1].size ==
+                                 offset;
+  bool merge_next =
+      i < arena->free_count && offset + size == arena->free[i].offset;
+
+  if (merge_prev && merge_next) {
+    arena->free[i - 1].size += size + arena->free[i].size;
+    memmove(&arena->free[i], &arena->free[i + 1],
+            (arena->free_count - i - 1) * sizeof(*arena->free));
+    arena->free_count--;
+  } else if (merge_prev) {
+    arena->free[i - 1].size += size;
+  } else if (merge_next) {
+    arena->free[i].offset = offset;
+    arena->free[i].size += size;
+  } else {
+    if (arena->free_count == arena->free_capacity) {
+      int capacity = arena->free_capacity ? arena->free_capacity * 2 : 16;
+      struct arena_extent *extents =
+          realloc(arena->free, capacity * sizeof(*arena->free));
+      if (!extents)
+        return;
+      arena->free = extents;
+      arena->free_capacity = capacity;
+    }
+    memmove(&arena->free[i + 1], &arena->free[i],
+            (arena->free_count - i) * sizeof(*arena->free));
+    arena->free[i].offset = offset;
+    arena->free[i].size = size;
+    arena->free_count++;
+  }
+}
+
+/* first fit over the free extents, growing the arena by at least half its
+ * size when nothing fits so that captures rarely move the mapping */
+static uint64_t arena_alloc(struct arena *arena, uint64_t size) {
+  for (int i = 0; i < arena->free_count; i++) {
+    if (arena->free[i].size >= size) {
+      uint64_t offset = arena->free[i].offset;
+      arena->free[i].offset += size;
+      arena->free[i].size -= size;
+      if (!arena->free[i].size) {
+        memmove(&arena->free[i], &arena->free[i + 1],
+                (arena->free_count - i - 1) * sizeof(*arena->free));
+        arena->free_count--;
+      }
+      return offset;
+    }
+  }
+
+  uint64_t offset = arena->size;
+  if (arena->free_count &&
+      arena->free[arena->free_count - 1].offset +
+              arena->free[arena->free_count - 1].size ==
+          arena->size)
+    offset = arena->free[--arena->free_count].offset;
+
+  uint64_t size_old = arena->size;
+  uint64_t size_new = offset + size;
+  if (size_new < size_old + size_old / 2)
+    size_new = arena_round(size_old + size_old / 2);
+  if (!arena_grow(arena, size_new)) {
+    if (offset < size_old)
+      arena_free(arena, offset, size_old - offset);
+    return 0;
+  }
+  arena_free(arena, offset + size, size_new - offset - size);
+
+  return offset;
+}
+
+/* anonymous, handed to clients over the query socket; sealed against
+ * shrinking so a client mapping can never run past its end */
+bool arena_open(struct arena *arena) {
+  memset(arena, 0, sizeof(*arena));
+
+  arena->fd = memfd_create("exposway-arena", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (arena->fd < 0)
+    return false;
+
+  if (!arena_grow(arena, arena_round(sizeof(struct arena_header))) ||
+      fcntl(arena->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) {
+    arena_close(arena);
+    return false;
+  }
+
+  arena->header->magic = ARENA_MAGIC;
+  arena->header->version = ARENA_VERSION;
+  arena->header->slot_count = ARENA_SLOTS;
+
+  return true;
+}
+
+int arena_lookup(struct arena *arena, int node, bool create) {
+  int vacant = -1;
+  for (int i = 0; i < ARENA_SLOTS; i++) {
+    if (arena->header->slots[i].node == node)
+      return i;
+    if (vacant < 0 && arena->header->slots[i].node == 0)
+      vacant = i;
+  }
+  if (!create || vacant < 0)
+    return -1;
+
+  struct arena_slot *slot = &arena->header->slots[vacant];
+  slot_begin(slot);
+  slot->node = node;
+  slot_end(slot);
+
+  return vacant;
+}
+
+void arena_update(struct arena *arena, int slot, int xcr, int ycr, int width,
+                  int height, const char *title) {
+  struct arena_slot *instance = &arena->header->slots[slot];
+
+  /* cut long titles on a character boundary so they stay valid UTF-8 */
+  size_t len = strlen(title);
+  if (len >= ARENA_TITLE) {
+    len = ARENA_TITLE - 1;
+    while (len > 0 && (title[len] & 0xC0) == 0x80)
+      len--;
+  }
+
+  slot_begin(instance);
+  instance->xcr = xcr;
+  instance->ycr = ycr;
+  instance->width = width;
+  instance->height = height;
+  memcpy(instance->title, title, len);
+  instance->title[len] = '\0';
+  slot_end(instance);
+}
+
+/* the slot's snapshot when it has the given geometry, NULL otherwise */
+static struct snapshot_header *arena_snapshot(struct arena *arena, int slot,
+                                              uint32_t width, uint32_t height) {
+  const struct arena_slot *instance = &arena->header->slots[slot];
+  if (!instance->offset)
+    return NULL;
+  struct snapshot_header *header =
+      (struct snapshot_header *)((unsigned char *)arena->header +
+                                 instance->offset);
+  if (header->width != width || header->height != height ||
+      header->tile_columns != (uint32_t)tile_columns(width) ||
+      header->tile_rows != (uint32_t)tile_rows(height))
+    return NULL;
+  return header;
+}
+
+/* true when the slot already holds exactly this capture */
+bool arena_same(struct arena *arena, int slot, int width, int height,
+                const uint32_t *hashes) {
+  struct snapshot_header *header = arena_snapshot(arena, slot, width, height);
+  if (!header)
+    return false;
+  const struct snapshot_tile *tiles =
+      (const struct snapshot_tile *)((unsigned char *)header + header->tiles);
+  for (uint32_t i = 0; i < header->tile_columns * header->tile_rows; i++)
+    if (tiles[i].hash != hashes[i])
+      return false;
+  return true;
+}
+
+/* copies one tile's squares at every level */
+static void arena_tile(struct snapshot_header *dest,
+                       const struct snapshot_header *src, int column,
+                       int row) {
+  for (uint32_t i = 0; i < src->levels; i++) {
+    const struct snapshot_level *level = &src->level[i];
+    int size = TILE_SIZE >> i;
+    int x = column * size, y = row * size;
+    int width = (int)level->width - x < size ? (int)level->width - x : size;
+    int height = (int)level->height - y < size ? (int)level->height - y : size;
+    for (int j = 0; j < height; j++) {
+      size_t at = level->offset + (size_t)(y + j) * level->stride + x * 4;
+      memcpy((unsigned char *)dest + at, (const unsigned char *)src + at,
+             (size_t)width * 4);
+    }
+  }
+}
+
+void arena_touch(struct arena *arena, int slot) {
+  arena->entries[slot].used = ++arena->touches;
+}
+
+size_t arena_stored(struct arena *arena) {
+  size_t stored = 0;
+  for (int i = 0; i < ARENA_SLOTS; i++)
+    if (arena->header->slots[i].node)
+      stored += arena->header->slots[i].extent;
+  return stored;
+}
+
+/* the least recently used slot holding a snapshot, other than keep */
+static int arena_oldest(struct arena *arena, int keep, bool undemoted) {
+  int oldest = -1;
+  for (int i = 0; i < ARENA_SLOTS; i++) {
+    if (i == keep || !arena->header->slots[i].offset ||
+        (undemoted && arena->entries[i].demoted))
+      continue;
+    if (oldest < 0 || arena->entries[i].used < arena->entries[oldest].used)
+      oldest = i;
+  }
+  return oldest;
+}
+
+/* the slot's snapshot now takes size bytes at its offset; the rest of its
+ * extent is handed back */
+static void arena_shrink(struct arena *arena, int slot, size_t size) {
+  struct arena_slot *instance = &arena->header->slots[slot];
+  uint64_t extent = arena_round(size);
+  if (extent >= instance->extent)
+    return;
+  arena_free(arena, instance->offset + extent, instance->extent - extent);
+  slot_begin(instance);
+  instance->extent = extent;
+  slot_end(instance);
+}
+
+/* rewrites the slot's snapshot, in place, in the lower tier; false when it
+ * has none to go down to */
+static bool arena_demote(struct arena *arena, int slot) {
+  struct arena_slot *instance = &arena->header->slots[slot];
+  unsigned char *dest = (unsigned char *)arena->header + instance->offset;
+  struct snapshot_header header;
+  memcpy(&header, dest, sizeof(header));
+  size_t size;
+
+  if (arena->demotion == ARENA_ENCODE) {
+    size = header.format == SNAPSHOT_ARGB32
+               ? snapshot_encode(&arena->scratch, &arena->scratch_capacity,
+                                 dest, SNAPSHOT_QOI)
+               : 0;
+    if (!size)
+      return false;
+    slot_begin(instance);
+    memcpy(dest, arena->scratch, size);
+  } else if (arena->demotion == ARENA_HALVE && header.levels > 1) {
+    /* the levels only move towards the header, so they can go one by one;
+     * the tiles no longer match any capture and are dropped */
+    size = arena_round(sizeof(header));
+    slot_begin(instance);
+    for (uint32_t i = 1; i < header.levels; i++) {
+      memmove(dest + size, dest + header.level[i].offset,
+              header.level[i].size);
+      header.level[i - 1] = header.level[i];
+      header.level[i - 1].offset = size;
+      size += arena_round(header.level[i].size);
+    }
+    header.levels--;
+    memset(&header.level[header.levels], 0, sizeof(*header.level));
+    header.width = header.level[0].width;
+    header.height = header.level[0].height;
+    header.stride = header.level[0].stride;
+    header.tile_columns = header.tile_rows = 0;
+    header.tiles = size;
+    header.dirty = 0;
+    memcpy(dest, &header, sizeof(header));
+  } else {
+    return false;
+  }
+
+  ((struct snapshot_header *)dest)->generation = ++arena->header->generation;
+  instance->generation = arena->header->generation;
+  slot_end(instance);
+  arena_shrink(arena, slot, size);
+  return true;
+}
+
+static void arena_evict(struct arena *arena, int slot) {
+  struct arena_slot *instance = &arena->header->slots[slot];
+  uint64_t offset = instance->offset, extent = instance->extent;
+  slot_begin(instance);
+  instance->offset = 0;
+  instance->extent = 0;
+  instance->generation = ++arena->header->generation;
+  slot_end(instance);
+  arena_free(arena, offset, extent);
+  arena->entries[slot].demoted = false;
+}
+
+/* brings the snapshots under budget, least recently used first, demoting
+ * every one that can be before evicting any; keep is the slot just
+ * captured */
+static void arena_trim(struct arena *arena, int keep) {
+  if (!arena->budget)
+    return;
+
+  while (arena_stored(arena) > arena->budget) {
+    int victim = arena->demotion == ARENA_EVICT
+                     ? -1
+                     : arena_oldest(arena, keep, true);
+    if (victim >= 0) {
+      arena->stats.demoted += arena_demote(arena, victim);
+      arena->entries[victim].demoted = true;
+      continue;
+    }
+    victim = arena_oldest(arena, keep, false);
+    if (victim < 0)
+      break;
+    arena_evict(arena, victim);
+    arena->stats.evicted++;
+  }
+}
+
+/* snapshot is a complete one out of snapshot_build or snapshot_encode; when
+ * the slot holds a raw one of the same geometry and so is this one, only the
+ * tiles whose hash differs are copied, and nothing at all when none does */
+int arena_commit(struct arena *arena, int slot, const unsigned char *snapshot,
+                 size_t size) {
+  const struct snapshot_header *fresh_header =
+      (const struct snapshot_header *)snapshot;
+  const struct snapshot_tile *fresh_tiles =
+      (const struct snapshot_tile *)(snapshot + fresh_header->tiles);
+  int count = fresh_header->tile_columns * fresh_header->tile_rows;
+  struct arena_slot *instance = &arena->header->slots[slot];
+
+  struct snapshot_header *header = arena_snapshot(
+      arena, slot, fresh_header->width, fresh_header->height);
+  if (header && header->format == SNAPSHOT_ARGB32 &&
+      fresh_header->format == SNAPSHOT_ARGB32) {
+    struct snapshot_tile *tiles =
+        (struct snapshot_tile *)((unsigned char *)header + header->tiles);
+    int dirty = 0;
+    for (int i = 0; i < count; i++)
+      dirty += tiles[i].hash != fresh_tiles[i].hash;
+    if (!dirty)
+      return 0;
+
+    slot_begin(instance);
+    uint64_t generation = ++arena->header->generation;
+    for (int i = 0; i < count; i++) {
+      if (tiles[i].hash == fresh_tiles[i].hash)
+        continue;
+      arena_tile(header, fresh_header, i % header->tile_columns,
+                 i / header->tile_columns);
+      tiles[i].hash = fresh_tiles[i].hash;
+      tiles[i].generation = generation;
+    }
+    header->generation = generation;
+    header->dirty = dirty;
+    instance->generation = generation;
+    slot_end(instance);
+    arena_touch(arena, slot);
+    return dirty;
+  }
+
+  uint64_t need = arena_round(size);
+  uint64_t offset = instance->offset;
+  uint64_t extent = instance->extent;
+  uint64_t stale = 0, stale_extent = 0; /* freed once nothing points there */
+
+  if (need > extent) {
+    uint64_t fresh = arena_alloc(arena, need);
+    if (!fresh)
+      return -1;
+    stale = offset;
+    stale_extent = extent;
+    offset = fresh;
+    extent = need;
+  }
+
+  /* arena_alloc may have moved the mapping */
+  instance = &arena->header->slots[slot];
+  unsigned char *dest = (unsigned char *)arena->header + offset;
+  header = (struct snapshot_header *)dest;
+
+  slot_begin(instance);
+  memcpy(dest, snapshot, size);
+  header->generation = ++arena->header->generation;
+  header->dirty = count;
+  struct snapshot_tile *tiles =
+      (struct snapshot_tile *)(dest + header->tiles);
+  for (int i = 0; i < count; i++)
+    tiles[i].generation = header->generation;
+  instance->offset = offset;
+  instance->extent = extent;
+  instance->generation = header->generation;
+  slot_end(instance);
+  arena_free(arena, stale, stale_extent);
+
+  arena_touch(arena, slot);
+  arena->entries[slot].demoted = false;
+  arena_trim(arena, slot);
+  return count;
+}
+
+void arena_release(struct arena *arena, int slot) {
+  struct arena_slot *instance = &arena->header->slots[slot];
+  uint64_t offset = instance->offset, extent = instance->extent;
+
+  slot_begin(instance);
+  uint32_t sequence = instance->sequence;
+  memset(instance, 0, sizeof(*instance));
+  instance->sequence = sequence;
+  slot_end(instance);
+  arena_free(arena, offset, extent);
+  arena->entries[slot] = (struct arena_entry){0};
+}
+
+void arena_close(struct arena *arena) {
+  if (arena->header)
+    munmap(arena->header, arena->size);
+  if (arena->fd >= 0)
+    close(arena->fd);
+  free(arena->free);
+  free(arena->scratch);
+  memset(arena, 0, sizeof(*arena));
+  arena->fd = -1;
+}
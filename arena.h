@@ -0,0 +1,108 @@
+#ifndef EXPOSWAY_ARENA_H
+#define EXPOSWAY_ARENA_H
+
+#include "snapshot.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_MAGIC 0x41505845 /* "EXPA" */
+#define ARENA_VERSION 4
+#define ARENA_SLOTS 256
+#define ARENA_TITLE 256
+#define ARENA_ALIGN 64
+
+/* one slot per window; sequence is odd while the daemon rewrites the slot,
+ * readers copy it out and retry until they see the same even value on both
+ * sides of the copy */
+struct arena_slot {
+  uint32_t sequence;
+  int32_t node; /* con_id, 0 when the slot is free */
+  int32_t xcr, ycr;
+  int32_t width, height;
+  uint64_t offset; /* of the snapshot_header, 0 before the first capture */
+  uint64_t extent; /* bytes reserved at offset */
+  uint64_t generation;
+  char title[ARENA_TITLE];
+};
+
+/* the arena starts with this header; snapshots, each laid out as a
+ * snapshot_header followed by its pixels, live behind it */
+struct arena_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t reserved;
+  uint64_t size; /* current length of the arena */
+  uint64_t generation;
+  struct arena_slot slots[ARENA_SLOTS];
+};
+
+enum arena_demotion {
+  ARENA_EVICT,  /* over budget, snapshots are dropped outright */
+  ARENA_HALVE,  /* first the full size level is dropped */
+  ARENA_ENCODE, /* first raw snapshots are encoded */
+};
+
+struct arena_stats {
+  unsigned long hits, misses; /* windows served with or without a snapshot */
+  unsigned long evicted, demoted;
+};
+
+struct arena {
+  int fd;
+  struct arena_header *header;
+  size_t size;
+
+  struct arena_extent {
+    uint64_t offset;
+    uint64_t size;
+  } *free;
+  int free_count, free_capacity;
+
+  /* daemon side only: the last focus or capture of each slot, counted in
+   * touches, and whether its snapshot was already demoted */
+  struct arena_entry {
+    uint64_t used;
+    bool demoted;
+  } entries[ARENA_SLOTS];
+  uint64_t touches;
+
+  size_t budget; /* snapshot bytes kept at most, 0 for no limit */
+  enum arena_demotion demotion;
+  unsigned char *scratch; /* where snapshots are encoded on demotion */
+  size_t scratch_capacity;
+  struct arena_stats stats;
+};
+
+bool arena_open(struct arena *arena);
+int arena_lookup(struct arena *arena, int node, bool create);
+void arena_update(struct arena *arena, int slot, int xcr, int ycr, int width,
+                  int height, const char *title);
+bool arena_same(struct arena *arena, int slot, int width, int height,
+                const uint32_t *hashes);
+int arena_commit(struct arena *arena, int slot, const unsigned char *snapshot,
+                 size_t size);
+void arena_touch(struct arena *arena, int slot);
+size_t arena_stored(struct arena *arena);
+void arena_release(struct arena *arena, int slot);
+void arena_close(struct arena *arena);
+
+static inline bool arena_slot_load(const struct arena_slot *slot,
+                                   struct arena_slot *copy) {
+  for (int retries = 0; retries < 1000; retries++) {
+    uint32_t begin = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (begin & 1)
+      continue;
+    memcpy(copy, slot, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == begin) {
+      copy->title[ARENA_TITLE - 1] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
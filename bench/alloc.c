@@ -0,0 +1,71 @@
+/* preloaded into exposwayd by bench/replay: counts every heap allocation
+ * into the file named by EXPOSWAY_ALLOCS, which the bench maps as well and
+ * reads while the daemon runs; glibc's own entry points do the work */
+#define _GNU_SOURCE
+#include "alloc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static struct alloc_counts *counts;
+
+__attribute__((constructor)) static void alloc_init(void) {
+  const char *path = getenv(ALLOC_ENV);
+  if (!path)
+    return;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  void *map = mmap(NULL, sizeof(*counts), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  close(fd);
+  if (map != MAP_FAILED)
+    counts = map;
+}
+
+static inline void alloc_count(size_t size) {
+  if (!counts)
+    return;
+  __atomic_fetch_add(&counts->calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&counts->bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+  alloc_count(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  alloc_count(count * size);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  alloc_count(size);
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  alloc_count(size);
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  void *block = memalign(alignment, size);
+  if (!block)
+    return ENOMEM;
+  *ptr = block;
+  return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef EXPOSWAY_BENCH_ALLOC_H
+#define EXPOSWAY_BENCH_ALLOC_H
+
+#include <stdint.h>
+
+#define ALLOC_ENV "EXPOSWAY_ALLOCS"
+
+/* the head of the file named by ALLOC_ENV, mapped shared by the preloaded
+ * counter and by whoever reads it */
+struct alloc_counts {
+  uint64_t calls;
+  uint64_t bytes;
+};
+
+#endif
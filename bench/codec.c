@@ -0,0 +1,168 @@
+/* size and speed of the snapshot codec against the PNG round trip grim and
+ * cairo used to make; reads a PNG screenshot, or synthesizes a desktop-like
+ * image when given none */
+#include "../codec.h"
+#include <cairo/cairo.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS_DFLT 20
+
+struct stream {
+  unsigned char *data;
+  size_t size, capacity, at;
+};
+
+static cairo_status_t stream_write(void *closure, const unsigned char *data,
+                                   unsigned int length) {
+  struct stream *stream = closure;
+  if (stream->size + length > stream->capacity) {
+    size_t capacity = stream->capacity ? stream->capacity * 2 : 1 << 20;
+    while (capacity < stream->size + length)
+      capacity *= 2;
+    unsigned char *grown = realloc(stream->data, capacity);
+    if (!grown)
+      return CAIRO_STATUS_NO_MEMORY;
+    stream->data = grown;
+    stream->capacity = capacity;
+  }
+  memcpy(stream->data + stream->size, data, length);
+  stream->size += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_status_t stream_read(void *closure, unsigned char *data,
+                                  unsigned int length) {
+  struct stream *stream = closure;
+  if (stream->at + length > stream->size)
+    return CAIRO_STATUS_READ_ERROR;
+  memcpy(data, stream->data + stream->at, length);
+  stream->at += length;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/* flat panels, lines of glyph-like strokes, a gradient and a noisy photo */
+static cairo_surface_t *synthesize(int width, int height) {
+  cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  unsigned char *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  uint32_t seed = 1;
+
+  for (int y = 0; y < height; y++) {
+    uint32_t *row = (uint32_t *)(data + (size_t)y * stride);
+    for (int x = 0; x < width; x++) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t px;
+      if (y < 24)
+        px = 0xFF1E1E2E;
+      else if (x < width / 2)
+        px = (y % 18 < 12 && (seed >> 16) % 3 == 0 && x % 120 < 100)
+                 ? 0xFFCDD6F4
+                 : 0xFF181825;
+      else if (y < height / 2)
+        px = 0xFF000000 | (x * 255 / width) << 16 | (y * 255 / height) << 8 |
+             0x80;
+      else
+        px = 0xFF000000 | (((seed >> 8) & 0x3F3F3F) + 0x404040);
+      row[x] = px;
+    }
+  }
+  cairo_surface_mark_dirty(surface);
+  return surface;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void report(const char *label, size_t size, size_t raw, double encode,
+                   double decode) {
+  printf("%-5s %6.1f%% %10zu bytes %9.1f MB/s encode %9.1f MB/s decode\n",
+         label, size * 100.0 / raw, size, raw / encode / 1e3,
+         raw / decode / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = ROUNDS_DFLT;
+  cairo_surface_t *source;
+
+  if (argc > 1) {
+    cairo_surface_t *png = cairo_image_surface_create_from_png(argv[1]);
+    if (cairo_surface_status(png) != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "Unable to read %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+    source = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                        cairo_image_surface_get_width(png),
+                                        cairo_image_surface_get_height(png));
+    cairo_t *cr = cairo_create(source);
+    cairo_set_source_surface(cr, png, 0, 0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(png);
+    if (argc > 2)
+      rounds = atoi(argv[2]);
+  } else {
+    source = synthesize(1920, 1080);
+  }
+  cairo_surface_flush(source);
+
+  int width = cairo_image_surface_get_width(source);
+  int height = cairo_image_surface_get_height(source);
+  int stride = cairo_image_surface_get_stride(source);
+  const unsigned char *data = cairo_image_surface_get_data(source);
+  size_t raw = (size_t)stride * height;
+
+  size_t limit = (size_t)width * height * 5;
+  unsigned char *encoded = malloc(limit);
+  unsigned char *decoded = malloc(raw);
+  size_t size = 0;
+  bool ok = true;
+
+  double start = now_ms();
+  for (int r = 0; r < rounds; r++)
+    size = codec_encode(data, width, height, stride, encoded, limit);
+  double encode = (now_ms() - start) / rounds;
+  start = now_ms();
+  for (int r = 0; r < rounds; r++)
+    ok &= codec_decode(encoded, size, decoded, width, height, stride);
+  double decode = (now_ms() - start) / rounds;
+  ok &= !memcmp(data, decoded, raw);
+
+  printf("%dx%d, %zu bytes raw, %d rounds\n", width, height, raw, rounds);
+  report("qoi", size, raw, encode, decode);
+
+  struct stream png = {0};
+  start = now_ms();
+  for (int r = 0; r < rounds; r++) {
+    png.size = 0;
+    cairo_surface_write_to_png_stream(source, stream_write, &png);
+  }
+  encode = (now_ms() - start) / rounds;
+  start = now_ms();
+  for (int r = 0; r < rounds; r++) {
+    png.at = 0;
+    cairo_surface_destroy(
+        cairo_image_surface_create_from_png_stream(stream_read, &png));
+  }
+  decode = (now_ms() - start) / rounds;
+  report("png", png.size, raw, encode, decode);
+
+  free(png.data);
+  free(encoded);
+  free(decoded);
+  cairo_surface_destroy(source);
+
+  if (!ok) {
+    fprintf(stderr, "Codec round trip differs\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
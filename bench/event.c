@@ -0,0 +1,163 @@
+/* throughput of the two window event parsers; reads a recording made with
+ * exposwayd -r or raw i3-ipc frames as captured off the sway socket, or
+ * synthesizes events when given none */
+#include "../event.h"
+#include "../record.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS_DFLT 200
+
+struct payload {
+  char *data;
+  size_t size;
+};
+
+struct corpus {
+  struct payload *items;
+  int count, capacity;
+  size_t bytes;
+};
+
+static void corpus_add(struct corpus *corpus, const char *data, size_t size) {
+  if (corpus->count == corpus->capacity) {
+    corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+    corpus->items =
+        realloc(corpus->items, corpus->capacity * sizeof(*corpus->items));
+  }
+  struct payload *item = &corpus->items[corpus->count++];
+  item->data = malloc(size + 1);
+  memcpy(item->data, data, size);
+  item->data[size] = '\0';
+  item->size = size;
+  corpus->bytes += size;
+}
+
+static int corpus_load(struct corpus *corpus, const char *path) {
+  struct record_entry *entries;
+  int count = record_load(path, &entries);
+  if (count < 0)
+    return -1;
+
+  for (int i = 0; i < count; i++)
+    if (entries[i].type == IPC_EVENT_WINDOW)
+      corpus_add(corpus, entries[i].payload, entries[i].size);
+  record_free(entries, count);
+  return corpus->count;
+}
+
+/* shaped like what sway sends: the interesting fields sit among a full
+ * container with nested nodes and window_properties */
+static void corpus_synthesize(struct corpus *corpus, int count) {
+  static const char *const changes[] = {"focus", "title", "move",
+                                        "fullscreen_mode", "close"};
+  char buf[4096];
+
+  for (int i = 0; i < count; i++) {
+    int n = snprintf(
+        buf, sizeof(buf),
+        "{\"change\": \"%s\", \"container\": {\"id\": %d, \"type\": \"con\", "
+        "\"orientation\": \"none\", \"percent\": 0.5, \"urgent\": false, "
+        "\"marks\": [], \"focused\": %s, \"layout\": \"none\", "
+        "\"border\": \"pixel\", \"current_border_width\": 2, "
+        "\"rect\": {\"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d}, "
+        "\"deco_rect\": {\"x\": 0, \"y\": 0, \"width\": 0, \"height\": 0}, "
+        "\"window_rect\": {\"x\": 2, \"y\": 2, \"width\": 956, \"height\": "
+        "1036}, \"geometry\": {\"x\": 0, \"y\": 0, \"width\": 956, "
+        "\"height\": 1036}, \"name\": \"terminal \\u2014 session %d: "
+        "~/src/\\\"proj\\\"\", \"window\": 4194307, \"nodes\": [], "
+        "\"floating_nodes\": [], \"focus\": [], \"fullscreen_mode\": 0, "
+        "\"sticky\": false, \"pid\": %d, \"app_id\": null, \"visible\": "
+        "true, \"max_render_time\": 0, \"shell\": \"xwayland\", "
+        "\"inhibit_idle\": false, \"idle_inhibitors\": {\"user\": \"none\", "
+        "\"application\": \"none\"}, \"window_properties\": {\"class\": "
+        "\"XTerm\", \"instance\": \"xterm\", \"title\": \"terminal\", "
+        "\"transient_for\": null}}}",
+        changes[i % 5], 10 + i % 40, i % 3 ? "true" : "false", i % 1920,
+        i % 1080, 480 + i % 960, 270 + i % 540, i, 1000 + i);
+    corpus_add(corpus, buf, n);
+  }
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bool same(const struct window_event *a, const struct window_event *b) {
+  return a->change == b->change && a->id == b->id &&
+         a->focused == b->focused && a->named == b->named &&
+         a->xcr == b->xcr && a->ycr == b->ycr && a->width == b->width &&
+         a->height == b->height && !strcmp(a->name, b->name);
+}
+
+static void run(const char *label, struct corpus *corpus, int rounds,
+                bool (*parse)(const char *, size_t, struct window_event *)) {
+  struct window_event event;
+  unsigned long failed = 0;
+
+  double start = now_ms();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < corpus->count; i++)
+      failed += !parse(corpus->items[i].data, corpus->items[i].size, &event);
+  double elapsed = now_ms() - start;
+
+  double events = (double)rounds * corpus->count;
+  printf("%-5s %10.0f events/s %9.1f MB/s %8.3f us/event", label,
+         events / elapsed * 1e3,
+         (double)rounds * corpus->bytes / elapsed / 1e3,
+         elapsed * 1e3 / events);
+  if (failed)
+    printf(" (%lu failed)", failed);
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  struct corpus corpus = {0};
+  int rounds = ROUNDS_DFLT;
+
+  if (argc > 1) {
+    if (corpus_load(&corpus, argv[1]) <= 0) {
+      fprintf(stderr, "No window events in %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+    if (argc > 2)
+      rounds = atoi(argv[2]);
+  } else {
+    corpus_synthesize(&corpus, 1000);
+  }
+
+  int mismatched = 0;
+  for (int i = 0; i < corpus.count; i++) {
+    struct window_event scanned, parsed;
+    bool ok_scan =
+        event_scan(corpus.items[i].data, corpus.items[i].size, &scanned);
+    bool ok_json =
+        event_json(corpus.items[i].data, corpus.items[i].size, &parsed);
+    if (ok_scan != ok_json || (ok_scan && !same(&scanned, &parsed))) {
+      if (!mismatched++)
+        fprintf(stderr, "Parsers disagree on event %d: %.*s\n", i,
+                (int)(corpus.items[i].size > 200 ? 200 : corpus.items[i].size),
+                corpus.items[i].data);
+    }
+  }
+
+  printf("%d events, %zu bytes, %d rounds\n", corpus.count, corpus.bytes,
+         rounds);
+  run("scan", &corpus, rounds, event_scan);
+  run("json", &corpus, rounds, event_json);
+
+  for (int i = 0; i < corpus.count; i++)
+    free(corpus.items[i].data);
+  free(corpus.items);
+
+  if (mismatched) {
+    fprintf(stderr, "%d events parsed differently\n", mismatched);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/* cost and quality of the Exposé layout as the window count grows; lays
+ * synthetic window sets out on monitors of several sizes, the way exposway
+ * does once it has its windows */
+#include "../layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS_DFLT 200
+
+static const int counts[] = {1,  2,   3,   5,   8,    12,  20,
+                             35, 60,  100, 200, 500, 1000, 2000};
+
+static const struct {
+  const char *name;
+  int width, height;
+} monitors[] = {
+    {"1366x768", 1366, 768},   {"1920x1080", 1920, 1080},
+    {"2560x1440", 2560, 1440}, {"3840x2160", 3840, 2160},
+    {"1080x1920", 1080, 1920},
+};
+
+/* tiled halves and quarters, terminals, dialogs, tall and wide windows and
+ * the odd one larger than the monitor, in proportion to the monitor */
+static void synthesize(struct wl_window *windows, int count, int width,
+                       int height) {
+  static const float shapes[][2] = {
+      {0.5f, 1.0f},   {0.5f, 0.5f},   {1.0f, 1.0f},  {0.38f, 0.42f},
+      {0.16f, 0.14f}, {0.25f, 0.95f}, {0.9f, 0.3f},  {0.33f, 0.5f},
+      {1.3f, 1.1f},   {0.62f, 0.7f},
+  };
+  uint32_t seed = 1;
+
+  for (int i = 0; i < count; i++) {
+    seed = seed * 1103515245 + 12345;
+    const float *shape = shapes[(seed >> 16) % 10];
+    float jitter = 0.85f + (seed >> 8 & 0xFF) / 850.0f;
+    windows[i] = (struct wl_window){
+        .node = 10 + i,
+        .width = width * shape[0] * jitter,
+        .height = height * shape[1] * jitter,
+    };
+  }
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : ROUNDS_DFLT;
+  if (rounds < 1)
+    rounds = 1;
+
+  int most = counts[sizeof(counts) / sizeof(*counts) - 1];
+  struct wl_window *source = malloc(most * sizeof(*source));
+  struct wl_window *windows = malloc(most * sizeof(*windows));
+  if (!source || !windows)
+    return EXIT_FAILURE;
+
+  printf("%d layouts per set\n", rounds);
+  printf("%-10s %7s %12s %6s %11s %8s\n", "monitor", "windows", "us/layout",
+         "nfdh", "efficiency", "scale");
+
+  for (size_t m = 0; m < sizeof(monitors) / sizeof(*monitors); m++) {
+    for (size_t c = 0; c < sizeof(counts) / sizeof(*counts); c++) {
+      int count = counts[c];
+      synthesize(source, count, monitors[m].width, monitors[m].height);
+
+      struct layout layout;
+      double elapsed = 0;
+      for (int r = 0; r < rounds; r++) {
+        memcpy(windows, source, count * sizeof(*windows));
+        layout = (struct layout){
+            .wl_window = windows,
+            .window_count = count,
+            .display_width = monitors[m].width,
+            .display_height = monitors[m].height,
+        };
+        double start = now_us();
+        _phantom(&layout);
+        _refine(_pack(&layout), &layout);
+        elapsed += now_us() - start;
+      }
+
+      /* thumbnails only, the margins around them do not count, nor what
+       * of one wider or taller than the output falls off it */
+      double covered = 0;
+      for (int i = 0; i < count; i++) {
+        double scale = windows[i].scale_factor;
+        double width = windows[i].width * scale;
+        double height = windows[i].height * scale;
+        if (width > monitors[m].width)
+          width = monitors[m].width;
+        if (height > monitors[m].height)
+          height = monitors[m].height;
+        covered += width * height;
+      }
+      printf("%-10s %7d %12.2f %6lu %10.1f%% %8.4f\n", monitors[m].name,
+             count, elapsed / rounds, layout.nfdh_calls,
+             covered * 100 / ((double)monitors[m].width * monitors[m].height),
+             windows[0].scale_factor);
+    }
+  }
+
+  free(source);
+  free(windows);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,340 @@
+/* frame time of exposway's drawing, stage by stage, as the window count,
+ * the output size and the title length grow; draws offscreen out of
+ * synthetic snapshots laid out the way exposwayd keeps them, into buffers
+ * handled the way exposway hands them to the compositor */
+#define _GNU_SOURCE
+#include "../arena.h"
+#include "../render.h"
+#include "../snapshot.h"
+#include "../tile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define WINDOWS_DFLT 12
+#define ROUNDS_DFLT 50
+#define TITLE_DFLT 32
+
+struct arena_buffer {
+  unsigned char *data;
+  size_t size, capacity;
+};
+
+/* a title bar, lines of glyph-like strokes and a gradient panel */
+static void synthesize(uint32_t *pixels, int width, int height,
+                       uint32_t seed) {
+  for (int y = 0; y < height; y++) {
+    uint32_t *row = pixels + (size_t)y * width;
+    for (int x = 0; x < width; x++) {
+      seed = seed * 1103515245 + 12345;
+      if (y < 24)
+        row[x] = 0xFF1E1E2E;
+      else if (x < width * 2 / 3)
+        row[x] = (y % 18 < 12 && (seed >> 16) % 3 == 0 && x % 120 < 100)
+                     ? 0xFFCDD6F4
+                     : 0xFF181825;
+      else
+        row[x] = 0xFF000000 | (x * 255 / width) << 16 |
+                 (y * 255 / height) << 8 | 0x80;
+    }
+  }
+}
+
+static uint64_t arena_append(struct arena_buffer *arena,
+                             const unsigned char *snapshot, size_t size) {
+  size_t offset = (arena->size + SNAPSHOT_ALIGN - 1) &
+                  ~(size_t)(SNAPSHOT_ALIGN - 1);
+  if (offset + size > arena->capacity) {
+    size_t capacity = arena->capacity ? arena->capacity : 1 << 24;
+    while (capacity < offset + size)
+      capacity *= 2;
+    unsigned char *grown = realloc(arena->data, capacity);
+    if (!grown)
+      return 0;
+    arena->data = grown;
+    arena->capacity = capacity;
+  }
+  memcpy(arena->data + offset, snapshot, size);
+  arena->size = offset + size;
+  return offset;
+}
+
+/* tiled halves and quarters, terminals, dialogs, tall and wide windows, in
+ * proportion to the output */
+static void populate(struct client_state *state, struct arena_buffer *arena,
+                     enum snapshot_format format, int title_length) {
+  static const float shapes[][2] = {
+      {0.5f, 1.0f},   {0.5f, 0.5f},   {1.0f, 1.0f}, {0.38f, 0.42f},
+      {0.16f, 0.14f}, {0.25f, 0.95f}, {0.9f, 0.3f}, {0.33f, 0.5f},
+  };
+  unsigned char *snapshot = NULL, *encoded = NULL;
+  size_t snapshot_capacity = 0, encoded_capacity = 0;
+  uint32_t seed = 1;
+
+  /* the windows' slots lead the arena, as exposwayd keeps them */
+  arena->data = calloc(1, sizeof(struct arena_header));
+  arena->size = arena->capacity = arena->data ? sizeof(struct arena_header) : 0;
+  for (int i = 0; i < state->window_count; i++) {
+    seed = seed * 1103515245 + 12345;
+    const float *shape = shapes[(seed >> 16) % 8];
+    int width = state->display_width * shape[0];
+    int height = state->display_height * shape[1];
+
+    uint32_t *pixels = malloc((size_t)width * height * 4);
+    uint32_t *hashes =
+        malloc(tile_columns(width) * tile_rows(height) * sizeof(*hashes));
+    synthesize(pixels, width, height, seed);
+    tile_hash((unsigned char *)pixels, width, height, width * 4, false,
+              hashes);
+    size_t size =
+        snapshot_build(&snapshot, &snapshot_capacity, (unsigned char *)pixels,
+                       width, height, width * 4, false, hashes);
+    size_t encoded_size =
+        snapshot_encode(&encoded, &encoded_capacity, snapshot, format);
+
+    struct wl_window *window = &state->wl_window[i];
+    window->node = 10 + i;
+    window->width = width;
+    window->height = height;
+    window->slot = i;
+    uint64_t offset = encoded_size
+                          ? arena_append(arena, encoded, encoded_size)
+                          : arena_append(arena, snapshot, size);
+    if (offset) {
+      struct arena_slot *slot = &((struct arena_header *)arena->data)->slots[i];
+      slot->node = window->node;
+      slot->offset = offset;
+    }
+    window->title = malloc(title_length + 1);
+    for (int c = 0; c < title_length; c++)
+      window->title[c] = "terminal - ~/src/exposway "[c % 26];
+    window->title[title_length] = '\0';
+
+    free(pixels);
+    free(hashes);
+  }
+  free(snapshot);
+  free(encoded);
+
+  state->arena = arena->data;
+  state->arena_size = arena->size;
+}
+
+static unsigned long damaged; /* pixels reported to the compositor */
+
+/* shared buffers mapped on the first frame and cycled through after it, as
+ * draw_cairo gets them; returns the buffer drawn into */
+static unsigned char *frame(struct client_state *state) {
+  static unsigned next;
+  static int framed[SHM_BUFFERS];
+  double begin = render_now();
+  int stride = state->display_width * 4;
+  size_t size = (size_t)stride * state->display_height;
+  if (!state->shm_data) {
+    int fd = memfd_create("render", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, size * SHM_BUFFERS) < 0)
+      return NULL;
+    unsigned char *data = mmap(NULL, size * SHM_BUFFERS,
+                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      return NULL;
+    state->shm_data = data;
+    state->shm_size = size * SHM_BUFFERS;
+    state->shown = RENDER_BLANK;
+    for (int i = 0; i < SHM_BUFFERS; i++)
+      framed[i] = RENDER_BLANK;
+  }
+  int buffer = next++ % SHM_BUFFERS;
+  unsigned char *data = state->shm_data + buffer * size;
+
+  double start = render_now();
+  render_update(state, data, stride, &framed[buffer]);
+  double rendered = render_now();
+
+  struct render_rect damage[RENDER_DAMAGE];
+  int count = render_damage(state, state->shown, framed[buffer], damage);
+  for (int i = 0; i < count; i++)
+    damaged += (unsigned long)damage[i].width * damage[i].height;
+  state->shown = framed[buffer];
+
+  state->stats.commit += render_now() - begin - (rendered - start);
+  return data;
+}
+
+static void report(const char *label, const struct render_stats *before,
+                   const struct render_stats *after, unsigned long pixels) {
+  unsigned long frames = after->frames - before->frames;
+  double decode = (after->decode - before->decode) / frames / 1e3;
+  double paint = (after->paint - before->paint) / frames / 1e3;
+  double title = (after->title - before->title) / frames / 1e3;
+  double commit = (after->commit - before->commit) / frames / 1e3;
+  printf("%-6s %5lu %9.3f %9.3f %9.3f %9.3f %9.3f %9.1f\n", label, frames,
+         decode + paint + title + commit, decode, paint, title, commit,
+         pixels / 1e3 / frames);
+}
+
+/* a buffer kept up to date frame after frame against one drawn whole */
+static bool same(struct client_state *state, const unsigned char *data) {
+  int stride = state->display_width * 4;
+  size_t size = (size_t)stride * state->display_height;
+  unsigned char *whole = malloc(size);
+  int framed = RENDER_BLANK;
+  bool same = whole && render_update(state, whole, stride, &framed) &&
+              !memcmp(whole, data, size);
+  free(whole);
+  return same;
+}
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-n windows] [-g WxH] [-t title_length] [-z raw|qoi] "
+          "[-r rounds] [-j threads] [-o dir]\n",
+          name);
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+  struct client_state state = {
+      .window_count = WINDOWS_DFLT,
+      .display_width = 1920,
+      .display_height = 1080,
+  };
+  enum snapshot_format format = SNAPSHOT_ARGB32;
+  int title_length = TITLE_DFLT, rounds = ROUNDS_DFLT, threads = 0;
+  const char *dir = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:g:t:z:r:j:o:")) != -1) {
+    switch (opt) {
+    case 'n':
+      state.window_count = atoi(optarg);
+      break;
+    case 'g':
+      if (sscanf(optarg, "%dx%d", &state.display_width,
+                 &state.display_height) != 2)
+        return usage(argv[0]);
+      break;
+    case 't':
+      title_length = atoi(optarg);
+      break;
+    case 'z':
+      if (!strcmp(optarg, "raw"))
+        format = SNAPSHOT_ARGB32;
+      else if (!strcmp(optarg, "qoi"))
+        format = SNAPSHOT_QOI;
+      else
+        return usage(argv[0]);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'o':
+      dir = optarg;
+      break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (state.window_count < 1 || state.window_count > ARENA_SLOTS ||
+      state.display_width < 64 || state.display_height < 64 ||
+      title_length < 0 || rounds < 1 || threads < 0)
+    return usage(argv[0]);
+
+  struct arena_buffer arena = {0};
+  state.wl_window = calloc(state.window_count, sizeof(*state.wl_window));
+  populate(&state, &arena, format, title_length);
+
+  struct layout layout = {
+      .wl_window = state.wl_window,
+      .window_count = state.window_count,
+      .display_width = state.display_width,
+      .display_height = state.display_height,
+  };
+  _phantom(&layout);
+  _refine(_pack(&layout), &layout);
+
+  /* the first frame pays for whatever the ones after it reuse, loading
+   * the thumbnails starts before it the way exposway starts it */
+  struct render_stats before = state.stats;
+  unsigned long pixels = damaged;
+  render_cache_start(&state, threads);
+
+  printf("%d windows on %dx%d, %s snapshots (%zu KiB), %d-character "
+         "titles, %d rounds, %d loading threads\n",
+         state.window_count, state.display_width, state.display_height,
+         format == SNAPSHOT_QOI ? "qoi" : "raw", arena.size / 1024,
+         title_length, rounds, state.loader.count);
+  printf("%-6s %5s %9s %9s %9s %9s %9s %9s\n", "frame", "count", "total ms",
+         "decode", "paint", "title", "commit", "damage");
+
+  frame(&state);
+  report("cold", &before, &state.stats, damaged - pixels);
+
+  before = state.stats;
+  pixels = damaged;
+  for (int r = 0; r < rounds; r++)
+    frame(&state);
+  report("warm", &before, &state.stats, damaged - pixels);
+
+  /* the frame redrawn each time an arrow key moves the focus */
+  state.frame_draw = true;
+  before = state.stats;
+  pixels = damaged;
+  unsigned char *last = NULL;
+  for (int r = 0; r < rounds; r++) {
+    state.window_focused = r % state.window_count;
+    last = frame(&state);
+  }
+  report("focus", &before, &state.stats, damaged - pixels);
+
+  /* the base drawn again out of the cached thumbnails and title masks, the
+   * title column against the cold frame's, which shaped them */
+  int stride = state.display_width * 4;
+  unsigned char *scratch = malloc((size_t)stride * state.display_height);
+  before = state.stats;
+  for (int r = 0; scratch && r < rounds; r++) {
+    int framed = RENDER_BLANK;
+    free(state.base);
+    state.base = NULL;
+    render_update(&state, scratch, stride, &framed);
+  }
+  report("base", &before, &state.stats, 0);
+  free(scratch);
+
+  printf("thumbnails %zu KiB, titles %zu KiB, base layer %zu KiB\n",
+         state.thumbnail_bytes / 1024, state.title_bytes / 1024,
+         (size_t)state.base_stride * state.display_height / 1024);
+
+  int failed = 0;
+  if (last && !same(&state, last)) {
+    fprintf(stderr, "Focus frames differ from a frame drawn whole\n");
+    failed++;
+  }
+  if (dir) {
+    char path[4096];
+    state.frame_draw = false;
+    snprintf(path, sizeof(path), "%s/full.png", dir);
+    failed += !render_png(&state, path);
+    state.frame_draw = true;
+    state.window_focused = 0;
+    snprintf(path, sizeof(path), "%s/focus.png", dir);
+    failed += !render_png(&state, path);
+    if (failed)
+      fprintf(stderr, "Unable to write frames to %s\n", dir);
+  }
+
+  for (int i = 0; i < state.window_count; i++)
+    free(state.wl_window[i].title);
+  free(state.wl_window);
+  free(arena.data);
+  render_fini(&state);
+  if (state.shm_data)
+    munmap(state.shm_data, state.shm_size);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
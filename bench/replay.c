@@ -0,0 +1,545 @@
+/* a fake sway IPC server replaying a recording of exposwayd's connections
+ * (exposwayd -r): requests get the replies recorded, events go out at
+ * their recorded timing or as fast as the daemon takes them. It serves
+ * $SWAYSOCK for a daemon started by hand, or with -x launches exposwayd
+ * itself on the null capture backend and reports throughput, latency,
+ * allocations and peak memory over the replay */
+#define _GNU_SOURCE
+#include "../event.h"
+#include "../ipc.h"
+#include "../record.h"
+#include "alloc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EVENT_BIT (1u << 31)
+#define CLIENTS 4
+#define REPLY_TYPES 16
+#define BACKLOG (256 * 1024) /* event bytes queued ahead of the daemon */
+#define STATS_MS "20"
+#define SETTLE_MS 5000 /* how long the final stats may take to show up */
+#define BUCKETS 32
+
+/* answers for a recording that has none, e.g. bare frames */
+static const char *const defaults[REPLY_TYPES] = {
+    [IPC_GET_WORKSPACES] =
+        "[{\"name\": \"1\", \"output\": \"HEADLESS-1\", \"focused\": true}]",
+    [IPC_SUBSCRIBE] = "{\"success\": true}",
+    [IPC_GET_OUTPUTS] =
+        "[{\"name\": \"HEADLESS-1\", \"active\": true, \"focused\": true, "
+        "\"scale\": 1.0, \"rect\": {\"x\": 0, \"y\": 0, \"width\": 1920, "
+        "\"height\": 1080}}]",
+    [IPC_GET_TREE] = "{\"id\": 1, \"type\": \"root\", \"nodes\": [], "
+                     "\"floating_nodes\": []}",
+};
+
+struct client {
+  int fd;
+  struct ipc_buffer in;
+  char *out;
+  size_t out_size, out_sent, out_capacity;
+  bool subscribed;
+};
+
+struct replay {
+  struct record_entry *entries;
+  int count;
+  int rounds;
+  bool fast;
+  uint64_t base; /* us, recorded time of the first event */
+
+  const struct record_entry *state[REPLY_TYPES];
+  int round, cursor;
+  int64_t round_start; /* us */
+  bool ended;          /* the closing workspace focus is out */
+
+  struct workspace_event workspace; /* the last one focused */
+  unsigned long sent, focused, trees;
+  int64_t first, last; /* us, first event sent and everything handled */
+};
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool client_queue(struct client *client, uint32_t type,
+                         const char *payload, uint32_t size) {
+  size_t need = IPC_HEADER_SIZE + size;
+  if (client->out_size + need > client->out_capacity && client->out_sent) {
+    memmove(client->out, client->out + client->out_sent,
+            client->out_size - client->out_sent);
+    client->out_size -= client->out_sent;
+    client->out_sent = 0;
+  }
+  if (client->out_size + need > client->out_capacity) {
+    size_t capacity = client->out_capacity ? client->out_capacity : 4096;
+    while (capacity < client->out_size + need)
+      capacity *= 2;
+    char *grown = realloc(client->out, capacity);
+    if (!grown)
+      return false;
+    client->out = grown;
+    client->out_capacity = capacity;
+  }
+
+  char *header = client->out + client->out_size;
+  memcpy(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1);
+  memcpy(header + sizeof(IPC_MAGIC) - 1, &size, sizeof(size));
+  memcpy(header + sizeof(IPC_MAGIC) - 1 + sizeof(size), &type, sizeof(type));
+  memcpy(header + IPC_HEADER_SIZE, payload, size);
+  client->out_size += need;
+  return true;
+}
+
+static bool client_flush(struct client *client) {
+  while (client->out_sent < client->out_size) {
+    ssize_t sent = send(client->fd, client->out + client->out_sent,
+                        client->out_size - client->out_sent,
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EINTR;
+    client->out_sent += sent;
+  }
+  client->out_size = client->out_sent = 0;
+  return true;
+}
+
+static void client_close(struct client *client) {
+  close(client->fd);
+  ipc_buffer_fini(&client->in);
+  free(client->out);
+  memset(client, 0, sizeof(*client));
+  client->fd = -1;
+}
+
+static void replay_answer(struct replay *replay, struct client *client,
+                          const struct ipc_frame *request) {
+  uint32_t type = request->type;
+  const char *payload = "[{\"success\": true}]";
+  uint32_t size = strlen(payload);
+
+  if (type < REPLY_TYPES && replay->state[type]) {
+    payload = replay->state[type]->payload;
+    size = replay->state[type]->size;
+  } else if (type < REPLY_TYPES && defaults[type]) {
+    payload = defaults[type];
+    size = strlen(payload);
+  }
+
+  if (type == IPC_SUBSCRIBE) {
+    client->subscribed = true;
+    replay->round_start = now_us();
+  }
+  if (type == IPC_GET_TREE)
+    replay->trees++;
+  client_queue(client, type, payload, size);
+}
+
+/* a workspace focus the daemon answers with GET_TREE, which tells when it
+ * got through everything sent before */
+static void replay_close(struct replay *replay, struct client *client) {
+  char payload[2 * EVENT_NAME_MAX + 64];
+  int size = snprintf(payload, sizeof(payload),
+                      "{\"change\": \"focus\", \"current\": {\"name\": "
+                      "\"%s\", \"output\": \"%s\"}}",
+                      replay->workspace.name, replay->workspace.output);
+  client_queue(client, IPC_EVENT_WORKSPACE, payload, size);
+  replay->sent++;
+  replay->focused++;
+  replay->ended = true;
+}
+
+/* queues events for the subscriber until the backlog is full or the next
+ * one is not yet due; returns the ms until it is, -1 when not waiting */
+static int replay_pump(struct replay *replay, struct client *client) {
+  int64_t now = now_us();
+
+  while (client->out_size - client->out_sent < BACKLOG) {
+    if (replay->round == replay->rounds) {
+      if (!replay->ended)
+        replay_close(replay, client);
+      return -1;
+    }
+    if (replay->cursor == replay->count) {
+      replay->round++;
+      replay->cursor = 0;
+      replay->round_start = now;
+      continue;
+    }
+
+    /* replies recorded after an event are the state the daemon finds when
+     * it asks about that event */
+    const struct record_entry *entry = &replay->entries[replay->cursor];
+    if (!(entry->type & EVENT_BIT)) {
+      if (entry->type < REPLY_TYPES)
+        replay->state[entry->type] = entry;
+      replay->cursor++;
+      continue;
+    }
+
+    if (!replay->fast) {
+      int64_t due = replay->round_start + (int64_t)(entry->time - replay->base);
+      if (due > now)
+        return (due - now + 999) / 1000;
+    }
+
+    struct workspace_event workspace;
+    if (entry->type == IPC_EVENT_WORKSPACE &&
+        event_workspace_scan(entry->payload, entry->size, &workspace) &&
+        workspace.change == CHANGE_FOCUS) {
+      replay->workspace = workspace;
+      replay->focused++;
+    }
+    if (!replay->sent)
+      replay->first = now;
+    client_queue(client, entry->type, entry->payload, entry->size);
+    replay->sent++;
+    replay->cursor++;
+  }
+  return -1;
+}
+
+/* the one GET_TREE at startup, then one per workspace focus */
+static bool replay_done(const struct replay *replay) {
+  return replay->ended && replay->trees >= replay->focused + 1;
+}
+
+struct stats {
+  unsigned long frames, count;
+  double le[BUCKETS];
+  unsigned long cumulative[BUCKETS];
+  int buckets;
+  double max;
+};
+
+static bool stats_read(const char *path, struct stats *stats) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return false;
+
+  memset(stats, 0, sizeof(*stats));
+  char line[512];
+  double le;
+  unsigned long value;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "exposway_ipc_frames_total %lu", &value) == 1)
+      stats->frames = value;
+    else if (sscanf(line, "exposway_event_seconds_bucket{le=\"%lf\"} %lu", &le,
+                    &value) == 2 &&
+             stats->buckets < BUCKETS) {
+      stats->le[stats->buckets] = le;
+      stats->cumulative[stats->buckets++] = value;
+    } else if (sscanf(line, "exposway_event_seconds_count %lu", &value) == 1)
+      stats->count = value;
+    else
+      sscanf(line, "exposway_event_seconds_max %lf", &stats->max);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+/* the bound of the first bucket holding quantile q, in us */
+static double stats_quantile(const struct stats *stats, double q) {
+  for (int i = 0; i < stats->buckets; i++)
+    if (stats->cumulative[i] >= q * stats->count)
+      return stats->le[i] * 1e6;
+  return stats->max * 1e6;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static pid_t daemon_spawn(const char *exposwayd, const char *dir,
+                          const char *socket_path, const char *allocs,
+                          const char *preload, char **extra, int extra_count) {
+  pid_t pid = fork();
+  if (pid)
+    return pid;
+
+  setenv("EXPOSWAYDIR", dir, 1);
+  setenv("SWAYSOCK", socket_path, 1);
+  if (preload) {
+    setenv(ALLOC_ENV, allocs, 1);
+    setenv("LD_PRELOAD", preload, 1);
+  }
+
+  char **args = calloc(extra_count + 6, sizeof(*args));
+  int n = 0;
+  args[n++] = (char *)exposwayd;
+  args[n++] = "-c";
+  args[n++] = "null";
+  args[n++] = "-m";
+  args[n++] = STATS_MS;
+  for (int i = 0; i < extra_count; i++)
+    args[n++] = extra[i];
+  execv(exposwayd, args);
+  fprintf(stderr, "Unable to run %s: %s\n", exposwayd, strerror(errno));
+  _exit(EXIT_FAILURE);
+}
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-f] [-n rounds] [-x exposwayd] [-a alloc.so] recording "
+          "[exposwayd options]\n",
+          name);
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+  struct replay replay = {.rounds = 1};
+  const char *exposwayd = NULL;
+  char preload[PATH_MAX];
+  snprintf(preload, sizeof(preload), "%s/alloc.so",
+           dirname(strdupa(argv[0])));
+
+  int opt;
+  while ((opt = getopt(argc, argv, "+fn:x:a:")) != -1) {
+    switch (opt) {
+    case 'f':
+      replay.fast = true;
+      break;
+    case 'n':
+      replay.rounds = atoi(optarg);
+      break;
+    case 'x':
+      exposwayd = optarg;
+      break;
+    case 'a':
+      snprintf(preload, sizeof(preload), "%s", optarg);
+      break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (optind >= argc || replay.rounds < 1)
+    return usage(argv[0]);
+
+  replay.count = record_load(argv[optind], &replay.entries);
+  if (replay.count < 0) {
+    fprintf(stderr, "Unable to read %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  /* the daemon's startup requests are answered out of the first replies */
+  bool events = false;
+  for (int i = replay.count - 1; i >= 0; i--) {
+    const struct record_entry *entry = &replay.entries[i];
+    if (entry->type & EVENT_BIT) {
+      replay.base = entry->time;
+      events = true;
+    } else if (entry->type < REPLY_TYPES) {
+      replay.state[entry->type] = entry;
+    }
+  }
+  if (!events) {
+    fprintf(stderr, "No events in %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  snprintf(replay.workspace.name, EVENT_NAME_MAX, "1");
+  snprintf(replay.workspace.output, EVENT_NAME_MAX, "HEADLESS-1");
+
+  char dir[] = "/tmp/exposway-replay.XXXXXX";
+  char socket_path[PATH_MAX], state[PATH_MAX + 8], allocs[PATH_MAX + 8];
+  struct alloc_counts *counts = NULL;
+  if (exposwayd) {
+    if (!mkdtemp(dir)) {
+      fprintf(stderr, "Unable to create %s\n", dir);
+      return EXIT_FAILURE;
+    }
+    snprintf(socket_path, sizeof(socket_path), "%s/sway.sock", dir);
+    snprintf(state, sizeof(state), "%s/state/", dir);
+    snprintf(allocs, sizeof(allocs), "%s/allocs", dir);
+    mkdir(state, 0700);
+    int fd = open(allocs, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd >= 0 && !ftruncate(fd, sizeof(*counts))) {
+      counts = mmap(NULL, sizeof(*counts), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+      if (counts == MAP_FAILED)
+        counts = NULL;
+    }
+    if (fd >= 0)
+      close(fd);
+    /* the daemon may run from elsewhere, so the preload is made absolute */
+    char resolved[PATH_MAX];
+    if (realpath(preload, resolved)) {
+      snprintf(preload, sizeof(preload), "%s", resolved);
+    } else {
+      fprintf(stderr, "No %s, allocations are not counted\n", preload);
+      counts = NULL;
+    }
+  } else if (getenv("SWAYSOCK")) {
+    snprintf(socket_path, sizeof(socket_path), "%s", getenv("SWAYSOCK"));
+    unlink(socket_path);
+  } else {
+    fprintf(stderr, "Set SWAYSOCK, or pass -x to launch exposwayd\n");
+    return EXIT_FAILURE;
+  }
+
+  /* a truncated path would be another socket than the daemon is told of */
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path %s too long\n", socket_path);
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, socket_path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0 ||
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, CLIENTS) < 0) {
+    fprintf(stderr, "Unable to listen on %s: %s\n", socket_path,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  pid_t pid = 0;
+  if (exposwayd)
+    pid = daemon_spawn(exposwayd, state, socket_path, allocs,
+                       counts ? preload : NULL, argv + optind + 1,
+                       argc - optind - 1);
+
+  struct client clients[CLIENTS];
+  for (int i = 0; i < CLIENTS; i++)
+    clients[i] = (struct client){.fd = -1};
+  struct alloc_counts before = {0}, after = {0};
+  bool failed = false;
+
+  while (!replay_done(&replay) && !failed) {
+    int timeout = -1;
+    for (int i = 0; i < CLIENTS; i++) {
+      if (clients[i].fd < 0 || !clients[i].subscribed)
+        continue;
+      if (!replay.sent && counts)
+        before = *counts;
+      timeout = replay_pump(&replay, &clients[i]);
+      failed |= !client_flush(&clients[i]);
+    }
+
+    struct pollfd fds[CLIENTS + 1] = {{.fd = listen_fd, .events = POLLIN}};
+    for (int i = 0; i < CLIENTS; i++)
+      fds[i + 1] = (struct pollfd){
+          .fd = clients[i].fd,
+          .events = POLLIN | (clients[i].out_size ? POLLOUT : 0),
+      };
+    /* a daemon that died is not going to ask for anything */
+    int delay = timeout < 0 || timeout > 100 ? 100 : timeout;
+    if (poll(fds, CLIENTS + 1, delay) < 0 && errno != EINTR)
+      break;
+    if (pid && waitpid(pid, NULL, WNOHANG) == pid) {
+      fprintf(stderr, "exposwayd exited during the replay\n");
+      pid = 0;
+      failed = true;
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+      for (int i = 0; fd >= 0 && i < CLIENTS; i++) {
+        if (clients[i].fd < 0 && ipc_buffer_init(&clients[i].in)) {
+          clients[i].fd = fd;
+          fd = -1;
+        }
+      }
+      if (fd >= 0)
+        close(fd);
+    }
+
+    for (int i = 0; i < CLIENTS; i++) {
+      struct client *client = &clients[i];
+      if (client->fd < 0 || !fds[i + 1].revents)
+        continue;
+      if (fds[i + 1].revents & POLLIN) {
+        ssize_t received = ipc_fill(&client->in, client->fd);
+        if (received == 0 ||
+            (received < 0 && errno != EAGAIN && errno != EINTR)) {
+          fprintf(stderr, "exposwayd hung up\n");
+          client_close(client);
+          failed = true;
+          continue;
+        }
+        struct ipc_frame request;
+        while (ipc_next(&client->in, &request) > 0)
+          replay_answer(&replay, client, &request);
+      }
+      failed |= !client_flush(client);
+    }
+  }
+  replay.last = now_us();
+  if (counts)
+    after = *counts;
+
+  double elapsed = (replay.last - replay.first) / 1e3;
+  printf("%lu events in %d rounds, %d frames recorded, %.1f ms, %.0f "
+         "events/s%s\n",
+         replay.sent, replay.rounds, replay.count, elapsed,
+         replay.sent / elapsed * 1e3, replay.fast ? "" : " at recorded timing");
+
+  /* the stats file catches up within a few of its intervals */
+  char stats_fn[PATH_MAX + 16];
+  const char *exposwaydir = exposwayd ? state : getenv("EXPOSWAYDIR");
+  struct stats stats = {0};
+  bool counted = false;
+  if (exposwaydir && !failed) {
+    snprintf(stats_fn, sizeof(stats_fn), "%sstats", exposwaydir);
+    for (int64_t start = now_us(); now_us() - start < SETTLE_MS * 1000;
+         usleep(10000))
+      if ((counted = stats_read(stats_fn, &stats) &&
+                     stats.frames >= replay.sent))
+        break;
+  }
+  if (counted)
+    printf("latency p50 <= %.0f us, p90 <= %.0f us, p99 <= %.0f us, max "
+           "%.0f us\n",
+           stats_quantile(&stats, 0.5), stats_quantile(&stats, 0.9),
+           stats_quantile(&stats, 0.99), stats.max * 1e6);
+  if (counts && replay.sent)
+    printf("%.2f allocations, %.0f bytes allocated per event\n",
+           (double)(after.calls - before.calls) / replay.sent,
+           (double)(after.bytes - before.bytes) / replay.sent);
+
+  /* stopped before hanging up, which it would take for sway going away */
+  if (pid) {
+    int status;
+    struct rusage usage;
+    kill(pid, SIGTERM);
+    if (wait4(pid, &status, 0, &usage) == pid) {
+      printf("peak RSS %ld KiB\n", usage.ru_maxrss);
+      failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+  }
+  for (int i = 0; i < CLIENTS; i++)
+    if (clients[i].fd >= 0)
+      client_close(&clients[i]);
+  close(listen_fd);
+  if (exposwayd)
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  else
+    unlink(socket_path);
+  record_free(replay.entries, replay.count);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
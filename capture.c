@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include "capture.h"
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+#include "xdg-output-unstable-v1-client-protocol.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#define GRIM_MAX_LNGTH 4096
+
+enum frame_status { FRAME_PENDING, FRAME_READY, FRAME_FAILED };
+
+static void output_geometry(void *data, struct wl_output *wl_output,
+                            int32_t xcr, int32_t ycr, int32_t physical_width,
+                            int32_t physical_height, int32_t subpixel,
+                            const char *make, const char *model,
+                            int32_t transform) {
+  struct capture_output *output = data;
+  output->xcr = xcr;
+  output->ycr = ycr;
+  output->transform = transform;
+}
+
+static void output_mode(void *data, struct wl_output *wl_output,
+                        uint32_t flags, int32_t width, int32_t height,
+                        int32_t refresh) {
+  struct capture_output *output = data;
+  if (flags & WL_OUTPUT_MODE_CURRENT) {
+    output->width = width;
+    output->height = height;
+  }
+}
+
+static void output_done(void *data, struct wl_output *wl_output) {}
+
+static void output_scale(void *data, struct wl_output *wl_output,
+                         int32_t factor) {
+  struct capture_output *output = data;
+  output->scale = factor;
+}
+
+static const struct wl_output_listener wl_output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+};
+
+static void xdg_output_position(void *data, struct zxdg_output_v1 *xdg_output,
+                                int32_t xcr, int32_t ycr) {
+  struct capture_output *output = data;
+  output->xcr = xcr;
+  output->ycr = ycr;
+}
+
+static void xdg_output_size(void *data, struct zxdg_output_v1 *xdg_output,
+                            int32_t width, int32_t height) {
+  struct capture_output *output = data;
+  output->logical_width = width;
+  output->logical_height = height;
+}
+
+static void xdg_output_done(void *data, struct zxdg_output_v1 *xdg_output) {}
+
+static void xdg_output_name(void *data, struct zxdg_output_v1 *xdg_output,
+                            const char *name) {}
+
+static void xdg_output_description(void *data,
+                                   struct zxdg_output_v1 *xdg_output,
+                                   const char *description) {}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+    .logical_position = xdg_output_position,
+    .logical_size = xdg_output_size,
+    .done = xdg_output_done,
+    .name = xdg_output_name,
+    .description = xdg_output_description,
+};
+
+/* outputs and the manager come in either order */
+static void output_describe(struct capture *cap,
+                            struct capture_output *output) {
+  if (!cap->xdg_output_manager || !output->wl_output || output->xdg_output)
+    return;
+  output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+      cap->xdg_output_manager, output->wl_output);
+  zxdg_output_v1_add_listener(output->xdg_output, &xdg_output_listener,
+                              output);
+}
+
+static void registry_global(void *data, struct wl_registry *wl_registry,
+                            uint32_t name, const char *interface,
+                            uint32_t version) {
+  struct capture *cap = data;
+
+  if (strcmp(interface, wl_shm_interface.name) == 0) {
+    cap->wl_shm = wl_registry_bind(wl_registry, name, &wl_shm_interface, 1);
+  } else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) ==
+             0) {
+    cap->screencopy = wl_registry_bind(
+        wl_registry, name, &zwlr_screencopy_manager_v1_interface, 1);
+  } else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
+    cap->xdg_output_manager =
+        wl_registry_bind(wl_registry, name, &zxdg_output_manager_v1_interface,
+                         version < 2 ? version : 2);
+    for (int i = 0; i < cap->output_count; i++)
+      output_describe(cap, &cap->outputs[i]);
+  } else if (strcmp(interface, wl_output_interface.name) == 0) {
+    int slot = 0;
+    while (slot < cap->output_count && cap->outputs[slot].wl_output)
+      slot++;
+    if (slot == CAPTURE_MAX_OUTPUTS)
+      return;
+    if (slot == cap->output_count)
+      cap->output_count++;
+    struct capture_output *output = &cap->outputs[slot];
+    memset(output, 0, sizeof(*output));
+    output->name = name;
+    output->scale = 1;
+    output->wl_output = wl_registry_bind(wl_registry, name,
+                                         &wl_output_interface,
+                                         version < 2 ? version : 2);
+    wl_output_add_listener(output->wl_output, &wl_output_listener, output);
+    output_describe(cap, output);
+  }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *wl_registry,
+                                   uint32_t name) {
+  struct capture *cap = data;
+
+  for (int i = 0; i < cap->output_count; i++) {
+    if (cap->outputs[i].wl_output && cap->outputs[i].name == name) {
+      if (cap->outputs[i].xdg_output)
+        zxdg_output_v1_destroy(cap->outputs[i].xdg_output);
+      cap->outputs[i].xdg_output = NULL;
+      wl_output_destroy(cap->outputs[i].wl_output);
+      cap->outputs[i].wl_output = NULL;
+      break;
+    }
+  }
+}
+
+static const struct wl_registry_listener wl_registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+/* the wl_buffer is rebuilt only when the compositor asks for a different
+ * geometry or format, and the backing memory only ever grows */
+static bool capture_reserve(struct capture *cap, uint32_t format,
+                            int32_t width, int32_t height, int32_t stride) {
+  if (cap->wl_buffer && cap->buffer_format == format &&
+      cap->buffer_width == width && cap->buffer_height == height &&
+      cap->buffer_stride == stride)
+    return true;
+
+  if (cap->wl_buffer) {
+    wl_buffer_destroy(cap->wl_buffer);
+    cap->wl_buffer = NULL;
+  }
+
+  size_t size = (size_t)stride * height;
+  if (size > cap->shm_size) {
+    if (cap->shm_fd < 0 &&
+        (cap->shm_fd = memfd_create("exposwayd", MFD_CLOEXEC)) < 0)
+      return false;
+    if (ftruncate(cap->shm_fd, size) < 0)
+      return false;
+    if (cap->shm_data)
+      munmap(cap->shm_data, cap->shm_size);
+    cap->shm_data =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cap->shm_fd, 0);
+    if (cap->shm_data == MAP_FAILED) {
+      cap->shm_data = NULL;
+      cap->shm_size = 0;
+      return false;
+    }
+    if (cap->wl_shm_pool)
+      wl_shm_pool_resize(cap->wl_shm_pool, size);
+    else
+      cap->wl_shm_pool = wl_shm_create_pool(cap->wl_shm, cap->shm_fd, size);
+    cap->shm_size = size;
+  }
+
+  cap->wl_buffer = wl_shm_pool_create_buffer(cap->wl_shm_pool, 0, width,
+                                             height, stride, format);
+  cap->buffer_format = format;
+  cap->buffer_width = width;
+  cap->buffer_height = height;
+  cap->buffer_stride = stride;
+
+  return cap->wl_buffer != NULL;
+}
+
+static void frame_buffer(void *data, struct zwlr_screencopy_frame_v1 *frame,
+                         uint32_t format, uint32_t width, uint32_t height,
+                         uint32_t stride) {
+  struct capture *cap = data;
+
+  if (!capture_reserve(cap, format, width, height, stride)) {
+    cap->frame_status = FRAME_FAILED;
+    return;
+  }
+  zwlr_screencopy_frame_v1_copy(frame, cap->wl_buffer);
+}
+
+static void frame_flags(void *data, struct zwlr_screencopy_frame_v1 *frame,
+                        uint32_t flags) {
+  struct capture *cap = data;
+  cap->frame_flags = flags;
+}
+
+static void frame_ready(void *data, struct zwlr_screencopy_frame_v1 *frame,
+                        uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                        uint32_t tv_nsec) {
+  struct capture *cap = data;
+  cap->frame_status = FRAME_READY;
+}
+
+static void frame_failed(void *data, struct zwlr_screencopy_frame_v1 *frame) {
+  struct capture *cap = data;
+  cap->frame_status = FRAME_FAILED;
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+    .buffer = frame_buffer,
+    .flags = frame_flags,
+    .ready = frame_ready,
+    .failed = frame_failed,
+};
+
+/* logical size, which is what sway reports window rectangles in; mode
+ * size over the integer scale is only right without fractional scaling */
+static void output_extent(struct capture_output *output, int *width,
+                          int *height) {
+  if (output->logical_width > 0 && output->logical_height > 0) {
+    *width = output->logical_width;
+    *height = output->logical_height;
+    return;
+  }
+  int scale = output->scale > 0 ? output->scale : 1;
+  *width = output->width / scale;
+  *height = output->height / scale;
+  if (output->transform & 1) {
+    int swap = *width;
+    *width = *height;
+    *height = swap;
+  }
+}
+
+static struct capture_output *capture_locate(struct capture *cap, int xcr,
+                                             int ycr) {
+  for (int i = 0; i < cap->output_count; i++) {
+    struct capture_output *output = &cap->outputs[i];
+    if (!output->wl_output)
+      continue;
+    int width, height;
+    output_extent(output, &width, &height);
+    if (xcr >= output->xcr && xcr < output->xcr + width &&
+        ycr >= output->ycr && ycr < output->ycr + height)
+      return output;
+  }
+  return NULL;
+}
+
+/* screen content is opaque whatever the alpha channel claims, so forcing
+ * alpha to 0xFF is all it takes to make the pixels premultiplied ARGB32 */
+static bool capture_convert(struct capture *cap) {
+  bool swizzle;
+  switch (cap->buffer_format) {
+  case WL_SHM_FORMAT_ARGB8888:
+  case WL_SHM_FORMAT_XRGB8888:
+    swizzle = false;
+    break;
+  case WL_SHM_FORMAT_ABGR8888:
+  case WL_SHM_FORMAT_XBGR8888:
+    swizzle = true;
+    break;
+  default:
+    return false;
+  }
+
+  for (int32_t y = 0; y < cap->buffer_height; y++) {
+    uint32_t *row =
+        (uint32_t *)(cap->shm_data + (size_t)y * cap->buffer_stride);
+    for (int32_t x = 0; x < cap->buffer_width; x++) {
+      uint32_t px = row[x];
+      if (swizzle)
+        px = (px & 0x0000FF00) | (px & 0x00FF0000) >> 16 |
+             (px & 0x000000FF) << 16;
+      row[x] = px | 0xFF000000;
+    }
+  }
+
+  return true;
+}
+
+static bool capture_screencopy(struct capture *cap, int xcr, int ycr,
+                               int width, int height,
+                               struct capture_image *image) {
+  struct capture_output *output =
+      capture_locate(cap, xcr + width / 2, ycr + height / 2);
+  if (!output)
+    return false;
+
+  int output_width, output_height;
+  output_extent(output, &output_width, &output_height);
+
+  int left = xcr - output->xcr, top = ycr - output->ycr;
+  int right = left + width, bottom = top + height;
+  left = left < 0 ? 0 : left;
+  top = top < 0 ? 0 : top;
+  right = right > output_width ? output_width : right;
+  bottom = bottom > output_height ? output_height : bottom;
+  if (right <= left || bottom <= top)
+    return false;
+
+  struct zwlr_screencopy_frame_v1 *frame =
+      zwlr_screencopy_manager_v1_capture_output_region(
+          cap->screencopy, 0, output->wl_output, left, top, right - left,
+          bottom - top);
+  cap->frame_flags = 0;
+  cap->frame_status = FRAME_PENDING;
+  zwlr_screencopy_frame_v1_add_listener(frame, &frame_listener, cap);
+
+  while (cap->frame_status == FRAME_PENDING)
+    if (wl_display_dispatch(cap->wl_display) == -1)
+      cap->frame_status = FRAME_FAILED;
+  zwlr_screencopy_frame_v1_destroy(frame);
+
+  if (cap->frame_status != FRAME_READY || !capture_convert(cap))
+    return false;
+
+  image->data = cap->shm_data;
+  image->width = cap->buffer_width;
+  image->height = cap->buffer_height;
+  image->stride = cap->buffer_stride;
+  image->invert = cap->frame_flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT;
+  return true;
+}
+
+/* grim hands over binary PPM on stdout, which is expanded to ARGB32 in
+ * place: each RGB row is read into the tail of its own ARGB row */
+static bool capture_grim(struct capture *cap, int xcr, int ycr, int width,
+                         int height, struct capture_image *image) {
+  char grim[GRIM_MAX_LNGTH];
+  snprintf(grim, sizeof(grim), "grim -t ppm -g \"%d,%d %dx%d\" -", xcr, ycr,
+           width, height);
+  FILE *fp = popen(grim, "r");
+  if (!fp)
+    return false;
+
+  int image_width, image_height, maxval;
+  bool ok = fscanf(fp, "P6 %d %d %d", &image_width, &image_height, &maxval) ==
+                3 &&
+            maxval == 255 && image_width > 0 && image_height > 0 &&
+            fgetc(fp) != EOF;
+
+  size_t stride = (size_t)image_width * 4;
+  if (ok && stride * image_height > cap->pixels_size) {
+    unsigned char *pixels = realloc(cap->pixels, stride * image_height);
+    if (pixels) {
+      cap->pixels = pixels;
+      cap->pixels_size = stride * image_height;
+    } else {
+      ok = false;
+    }
+  }
+
+  for (int y = 0; ok && y < image_height; y++) {
+    unsigned char *row = cap->pixels + y * stride;
+    unsigned char *rgb = row + image_width;
+    ok = fread(rgb, 3, image_width, fp) == (size_t)image_width;
+    for (int x = 0; ok && x < image_width; x++)
+      ((uint32_t *)row)[x] = 0xFF000000 | rgb[3 * x] << 16 |
+                             rgb[3 * x + 1] << 8 | rgb[3 * x + 2];
+  }
+  ok = pclose(fp) == 0 && ok;
+
+  image->data = cap->pixels;
+  image->width = image_width;
+  image->height = image_height;
+  image->stride = stride;
+  image->invert = false;
+  return ok;
+}
+
+/* the requested rectangle at one pixel per unit, a flat colour of its
+ * position with one band of tiles that moves on every capture, so the
+ * hashing, the filter and the commit all see some work */
+static bool capture_null(struct capture *cap, int xcr, int ycr, int width,
+                         int height, struct capture_image *image) {
+  if (width <= 0 || height <= 0)
+    return false;
+
+  size_t stride = (size_t)width * 4;
+  if (stride * height > cap->pixels_size) {
+    unsigned char *pixels = realloc(cap->pixels, stride * height);
+    if (!pixels)
+      return false;
+    cap->pixels = pixels;
+    cap->pixels_size = stride * height;
+  }
+
+  uint32_t base =
+      0xFF000000 | ((uint32_t)xcr * 2654435761u ^ (uint32_t)ycr * 40503u) >> 8;
+  uint32_t band = 0xFF000000 | cap->serial * 0x10101;
+  int band_top = cap->serial++ * 64 % height;
+  for (int y = 0; y < height; y++) {
+    uint32_t *row = (uint32_t *)(cap->pixels + y * stride);
+    uint32_t px = y >= band_top && y < band_top + 64 ? band : base;
+    for (int x = 0; x < width; x++)
+      row[x] = px;
+  }
+
+  image->data = cap->pixels;
+  image->width = width;
+  image->height = height;
+  image->stride = stride;
+  image->invert = false;
+  return true;
+}
+
+bool capture_init(struct capture *cap, enum capture_backend backend) {
+  memset(cap, 0, sizeof(*cap));
+  cap->backend = backend;
+  cap->shm_fd = -1;
+
+  if (backend == CAPTURE_GRIM || backend == CAPTURE_NULL)
+    return true;
+
+  cap->wl_display = wl_display_connect(NULL);
+  if (!cap->wl_display)
+    return false;
+
+  cap->wl_registry = wl_display_get_registry(cap->wl_display);
+  wl_registry_add_listener(cap->wl_registry, &wl_registry_listener, cap);
+  wl_display_roundtrip(cap->wl_display);
+  wl_display_roundtrip(cap->wl_display);
+
+  if (!cap->wl_shm || !cap->screencopy || !cap->output_count) {
+    capture_fini(cap);
+    return false;
+  }
+
+  return true;
+}
+
+bool capture_window(struct capture *cap, int xcr, int ycr, int width,
+                    int height, struct capture_image *image) {
+  if (cap->backend == CAPTURE_GRIM)
+    return capture_grim(cap, xcr, ycr, width, height, image);
+  if (cap->backend == CAPTURE_NULL)
+    return capture_null(cap, xcr, ycr, width, height, image);
+  return capture_screencopy(cap, xcr, ycr, width, height, image);
+}
+
+void capture_fini(struct capture *cap) {
+  if (cap->wl_buffer)
+    wl_buffer_destroy(cap->wl_buffer);
+  if (cap->wl_shm_pool)
+    wl_shm_pool_destroy(cap->wl_shm_pool);
+  if (cap->shm_data)
+    munmap(cap->shm_data, cap->shm_size);
+  if (cap->shm_fd >= 0)
+    close(cap->shm_fd);
+  free(cap->pixels);
+  for (int i = 0; i < cap->output_count; i++) {
+    if (cap->outputs[i].xdg_output)
+      zxdg_output_v1_destroy(cap->outputs[i].xdg_output);
+    if (cap->outputs[i].wl_output)
+      wl_output_destroy(cap->outputs[i].wl_output);
+  }
+  if (cap->xdg_output_manager)
+    zxdg_output_manager_v1_destroy(cap->xdg_output_manager);
+  if (cap->screencopy)
+    zwlr_screencopy_manager_v1_destroy(cap->screencopy);
+  if (cap->wl_shm)
+    wl_shm_destroy(cap->wl_shm);
+  if (cap->wl_registry)
+    wl_registry_destroy(cap->wl_registry);
+  if (cap->wl_display)
+    wl_display_disconnect(cap->wl_display);
+
+  memset(cap, 0, sizeof(*cap));
+  cap->shm_fd = -1;
+}
@@ -0,0 +1,68 @@
+#ifndef EXPOSWAY_CAPTURE_H
+#define EXPOSWAY_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_MAX_OUTPUTS 16
+
+enum capture_backend {
+  CAPTURE_SCREENCOPY, /* in-process, wlr-screencopy into a reused shm buffer */
+  CAPTURE_GRIM,       /* fork grim per capture, PPM over a pipe */
+  CAPTURE_NULL,       /* no compositor, a synthesized image, for benches */
+};
+
+struct capture_output {
+  struct wl_output *wl_output;
+  struct zxdg_output_v1 *xdg_output;
+  uint32_t name;
+  int32_t xcr, ycr;
+  int32_t width, height;
+  int32_t scale;
+  int32_t transform;
+  /* the rectangle in the layout, from xdg-output; the integer scale only
+   * approximates it under fractional scaling */
+  int32_t logical_width, logical_height;
+};
+
+/* ARGB32 rows owned by the capture context, valid until its next capture */
+struct capture_image {
+  const unsigned char *data;
+  int width, height, stride;
+  bool invert;
+};
+
+struct capture {
+  enum capture_backend backend;
+
+  struct wl_display *wl_display;
+  struct wl_registry *wl_registry;
+  struct wl_shm *wl_shm;
+  struct zwlr_screencopy_manager_v1 *screencopy;
+  struct zxdg_output_manager_v1 *xdg_output_manager;
+  struct capture_output outputs[CAPTURE_MAX_OUTPUTS];
+  int output_count;
+
+  int shm_fd;
+  size_t shm_size;
+  unsigned char *shm_data;
+  struct wl_shm_pool *wl_shm_pool;
+  struct wl_buffer *wl_buffer;
+  uint32_t buffer_format;
+  int32_t buffer_width, buffer_height, buffer_stride;
+
+  uint32_t frame_flags;
+  int frame_status;
+
+  unsigned char *pixels;
+  size_t pixels_size;
+  uint32_t serial; /* captures taken, moves the synthesized content */
+};
+
+bool capture_init(struct capture *cap, enum capture_backend backend);
+bool capture_window(struct capture *cap, int xcr, int ycr, int width,
+                    int height, struct capture_image *image);
+void capture_fini(struct capture *cap);
+
+#endif
@@ -0,0 +1,154 @@
+#include "codec.h"
+#include <stdint.h>
+
+#define CODEC_INDEX 0x00 /* 00iiiiii */
+#define CODEC_DIFF 0x40  /* 01rrggbb, each -2..1 */
+#define CODEC_LUMA 0x80  /* 10gggggg, then rrrrbbbb relative to green */
+#define CODEC_RUN 0xC0   /* 11llllll, 1..62 repeats */
+#define CODEC_RGB 0xFE
+#define CODEC_ARGB 0xFF
+#define CODEC_RUN_MAX 62
+
+#define CODEC_START 0xFF000000 /* opaque black comes before the first pixel */
+
+static inline unsigned codec_index(uint32_t px) {
+  return ((px >> 16 & 0xFF) * 3 + (px >> 8 & 0xFF) * 5 + (px & 0xFF) * 7 +
+          (px >> 24) * 11) &
+         63;
+}
+
+/* px with its colour replaced, each channel wrapping around */
+static inline uint32_t codec_rgb(uint32_t px, uint32_t r, uint32_t g,
+                                 uint32_t b) {
+  return (px & 0xFF000000) | (r & 0xFF) << 16 | (g & 0xFF) << 8 | (b & 0xFF);
+}
+
+size_t codec_encode(const unsigned char *data, int width, int height,
+                    int stride, unsigned char *dest, size_t limit) {
+  uint32_t index[64] = {0};
+  uint32_t prev = CODEC_START;
+  size_t p = 0;
+  int run = 0;
+
+  for (int y = 0; y < height; y++) {
+    const uint32_t *row = (const uint32_t *)(data + (size_t)y * stride);
+    for (int x = 0; x < width; x++) {
+      uint32_t px = row[x];
+      if (px == prev) {
+        if (++run == CODEC_RUN_MAX) {
+          if (p >= limit)
+            return 0;
+          dest[p++] = CODEC_RUN | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+
+      /* a pending run and the longest op */
+      if (p + 6 > limit)
+        return 0;
+      if (run) {
+        dest[p++] = CODEC_RUN | (run - 1);
+        run = 0;
+      }
+
+      unsigned hash = codec_index(px);
+      if (index[hash] == px) {
+        dest[p++] = CODEC_INDEX | hash;
+      } else {
+        index[hash] = px;
+        if ((px ^ prev) >> 24) {
+          dest[p++] = CODEC_ARGB;
+          dest[p++] = px >> 16;
+          dest[p++] = px >> 8;
+          dest[p++] = px;
+          dest[p++] = px >> 24;
+        } else {
+          int8_t dr = (px >> 16) - (prev >> 16);
+          int8_t dg = (px >> 8) - (prev >> 8);
+          int8_t db = px - prev;
+          int8_t dr_dg = dr - dg, db_dg = db - dg;
+          if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+              db <= 1) {
+            dest[p++] = CODEC_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+          } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                     db_dg >= -8 && db_dg <= 7) {
+            dest[p++] = CODEC_LUMA | (dg + 32);
+            dest[p++] = (dr_dg + 8) << 4 | (db_dg + 8);
+          } else {
+            dest[p++] = CODEC_RGB;
+            dest[p++] = px >> 16;
+            dest[p++] = px >> 8;
+            dest[p++] = px;
+          }
+        }
+      }
+      prev = px;
+    }
+  }
+
+  if (run) {
+    if (p >= limit)
+      return 0;
+    dest[p++] = CODEC_RUN | (run - 1);
+  }
+  return p;
+}
+
+bool codec_decode(const unsigned char *src, size_t size, unsigned char *data,
+                  int width, int height, int stride) {
+  uint32_t index[64] = {0};
+  uint32_t px = CODEC_START;
+  const unsigned char *end = src + size;
+  int run = 0;
+
+  for (int y = 0; y < height; y++) {
+    uint32_t *row = (uint32_t *)(data + (size_t)y * stride);
+    for (int x = 0; x < width; x++) {
+      if (run) {
+        run--;
+        row[x] = px;
+        continue;
+      }
+      if (src == end)
+        return false;
+
+      unsigned op = *src++;
+      if (op == CODEC_RGB) {
+        if (end - src < 3)
+          return false;
+        px = codec_rgb(px, src[0], src[1], src[2]);
+        src += 3;
+        index[codec_index(px)] = px;
+      } else if (op == CODEC_ARGB) {
+        if (end - src < 4)
+          return false;
+        px = (uint32_t)src[3] << 24 | src[0] << 16 | src[1] << 8 | src[2];
+        src += 4;
+        index[codec_index(px)] = px;
+      } else if ((op & 0xC0) == CODEC_INDEX) {
+        px = index[op];
+      } else if ((op & 0xC0) == CODEC_DIFF) {
+        uint32_t r = (px >> 16) + (op >> 4 & 3) - 2;
+        uint32_t g = (px >> 8) + (op >> 2 & 3) - 2;
+        uint32_t b = px + (op & 3) - 2;
+        px = codec_rgb(px, r, g, b);
+        index[codec_index(px)] = px;
+      } else if ((op & 0xC0) == CODEC_LUMA) {
+        if (src == end)
+          return false;
+        int dg = (int)(op & 0x3F) - 32;
+        int dr = dg + (*src >> 4) - 8;
+        int db = dg + (*src & 0x0F) - 8;
+        src++;
+        uint32_t r = (px >> 16) + dr, g = (px >> 8) + dg, b = px + db;
+        px = codec_rgb(px, r, g, b);
+        index[codec_index(px)] = px;
+      } else {
+        run = op & 0x3F;
+      }
+      row[x] = px;
+    }
+  }
+  return src == end && !run;
+}
@@ -0,0 +1,18 @@
+#ifndef EXPOSWAY_CODEC_H
+#define EXPOSWAY_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* a QOI-style lossless stream of native-endian ARGB32 words, without the
+ * QOI header and end marker; the size and geometry are kept by whoever
+ * stores it */
+
+/* returns the stream's size, or 0 when it would not fit in limit bytes */
+size_t codec_encode(const unsigned char *data, int width, int height,
+                    int stride, unsigned char *dest, size_t limit);
+/* false on a truncated or overlong stream */
+bool codec_decode(const unsigned char *src, size_t size, unsigned char *data,
+                  int width, int height, int stride);
+
+#endif
@@ -0,0 +1,489 @@
+#include "event.h"
+#include <json.h>
+#include <string.h>
+
+#define KEY(literal)                                                           \
+  (len == sizeof(literal) - 1 && !memcmp(key, literal, sizeof(literal) - 1))
+
+static const char *const change_names[] = {
+    [CHANGE_OTHER] = "other",
+    [CHANGE_NEW] = "new",
+    [CHANGE_CLOSE] = "close",
+    [CHANGE_FOCUS] = "focus",
+    [CHANGE_TITLE] = "title",
+    [CHANGE_FULLSCREEN_MODE] = "fullscreen_mode",
+    [CHANGE_MOVE] = "move",
+    [CHANGE_FLOATING] = "floating",
+    [CHANGE_URGENT] = "urgent",
+    [CHANGE_MARK] = "mark",
+    [CHANGE_INIT] = "init",
+    [CHANGE_EMPTY] = "empty",
+    [CHANGE_RENAME] = "rename",
+    [CHANGE_RELOAD] = "reload",
+};
+
+const char *event_change_name(enum event_change change) {
+  return change_names[change];
+}
+
+static enum event_change change_lookup(const char *key, size_t len) {
+  for (size_t i = 1; i < sizeof(change_names) / sizeof(*change_names); i++)
+    if (strlen(change_names[i]) == len && !memcmp(key, change_names[i], len))
+      return i;
+  return CHANGE_OTHER;
+}
+
+/* copies as much of a UTF-8 string as fits, never splitting a character */
+static void event_text(char *dest, const char *src, size_t len) {
+  if (len >= EVENT_NAME_MAX) {
+    len = EVENT_NAME_MAX - 1;
+    while (len > 0 && (src[len] & 0xC0) == 0x80)
+      len--;
+  }
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+}
+
+struct cursor {
+  const char *p, *end;
+};
+
+static void skip_space(struct cursor *c) {
+  while (c->p < c->end &&
+         (*c->p == ' ' || *c->p == '\n' || *c->p == '\r' || *c->p == '\t'))
+    c->p++;
+}
+
+static bool expect(struct cursor *c, char ch) {
+  skip_space(c);
+  if (c->p < c->end && *c->p == ch) {
+    c->p++;
+    return true;
+  }
+  return false;
+}
+
+/* the raw contents between the quotes, escapes left untouched */
+static bool scan_string(struct cursor *c, const char **str, size_t *len) {
+  if (!expect(c, '"'))
+    return false;
+  const char *start = c->p;
+  while (c->p < c->end) {
+    const char *quote = memchr(c->p, '"', c->end - c->p);
+    if (!quote)
+      break;
+    const char *back = quote;
+    while (back > start && back[-1] == '\\')
+      back--;
+    c->p = quote + 1;
+    if ((quote - back) % 2 == 0) {
+      *str = start;
+      *len = quote - start;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool skip_value(struct cursor *c) {
+  const char *str;
+  size_t len;
+
+  skip_space(c);
+  if (c->p == c->end)
+    return false;
+  if (*c->p == '"')
+    return scan_string(c, &str, &len);
+
+  if (*c->p == '{' || *c->p == '[') {
+    int depth = 0;
+    while (c->p < c->end) {
+      switch (*c->p) {
+      case '"':
+        if (!scan_string(c, &str, &len))
+          return false;
+        continue;
+      case '{':
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        if (--depth == 0) {
+          c->p++;
+          return true;
+        }
+        break;
+      }
+      c->p++;
+    }
+    return false;
+  }
+
+  while (c->p < c->end && *c->p != ',' && *c->p != '}' && *c->p != ']' &&
+         *c->p != ' ' && *c->p != '\n' && *c->p != '\r' && *c->p != '\t')
+    c->p++;
+  return true;
+}
+
+static bool scan_int(struct cursor *c, int *value) {
+  skip_space(c);
+  bool negative = c->p < c->end && *c->p == '-';
+  if (negative)
+    c->p++;
+  if (c->p == c->end || *c->p < '0' || *c->p > '9')
+    return false;
+  long n = 0;
+  while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+    n = n * 10 + (*c->p++ - '0');
+  *value = negative ? -n : n;
+  /* sway only sends integers here, but do not choke on a fraction */
+  return skip_value(c);
+}
+
+static bool scan_literal(struct cursor *c, const char *literal) {
+  size_t len = strlen(literal);
+  skip_space(c);
+  if ((size_t)(c->end - c->p) < len || memcmp(c->p, literal, len))
+    return false;
+  c->p += len;
+  return true;
+}
+
+static int hex_value(const char *s) {
+  int value = 0;
+  for (int i = 0; i < 4; i++) {
+    char ch = s[i];
+    value <<= 4;
+    if (ch >= '0' && ch <= '9')
+      value |= ch - '0';
+    else if (ch >= 'a' && ch <= 'f')
+      value |= ch - 'a' + 10;
+    else if (ch >= 'A' && ch <= 'F')
+      value |= ch - 'A' + 10;
+    else
+      return -1;
+  }
+  return value;
+}
+
+/* unescapes a string value into dest, which holds EVENT_NAME_MAX bytes;
+ * present is cleared for null */
+static bool scan_text(struct cursor *c, char *dest, bool *present) {
+  const char *str;
+  size_t len;
+
+  if (scan_literal(c, "null")) {
+    *present = false;
+    return true;
+  }
+  if (!scan_string(c, &str, &len))
+    return false;
+  *present = true;
+
+  size_t n = 0;
+  for (size_t i = 0; i < len;) {
+    char utf8[4];
+    size_t width = 1;
+    if (str[i] != '\\') {
+      /* copy whole characters so truncation stays on a boundary */
+      unsigned char lead = str[i];
+      width = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+      if (i + width > len)
+        width = len - i;
+      memcpy(utf8, str + i, width);
+      i += width;
+    } else {
+      if (i + 1 >= len)
+        return false;
+      char escape = str[i + 1];
+      i += 2;
+      switch (escape) {
+      case 'b':
+        utf8[0] = '\b';
+        break;
+      case 'f':
+        utf8[0] = '\f';
+        break;
+      case 'n':
+        utf8[0] = '\n';
+        break;
+      case 'r':
+        utf8[0] = '\r';
+        break;
+      case 't':
+        utf8[0] = '\t';
+        break;
+      case 'u': {
+        if (i + 4 > len)
+          return false;
+        long code = hex_value(str + i);
+        i += 4;
+        if (code >= 0xD800 && code < 0xDC00 && i + 6 <= len &&
+            str[i] == '\\' && str[i + 1] == 'u') {
+          int low = hex_value(str + i + 2);
+          if (low >= 0xDC00 && low < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            i += 6;
+          }
+        }
+        if (code < 0)
+          return false;
+        if (code >= 0xD800 && code < 0xE000)
+          code = 0xFFFD;
+        if (code < 0x80) {
+          utf8[0] = code;
+        } else if (code < 0x800) {
+          utf8[0] = 0xC0 | code >> 6;
+          utf8[1] = 0x80 | (code & 0x3F);
+          width = 2;
+        } else if (code < 0x10000) {
+          utf8[0] = 0xE0 | code >> 12;
+          utf8[1] = 0x80 | (code >> 6 & 0x3F);
+          utf8[2] = 0x80 | (code & 0x3F);
+          width = 3;
+        } else {
+          utf8[0] = 0xF0 | code >> 18;
+          utf8[1] = 0x80 | (code >> 12 & 0x3F);
+          utf8[2] = 0x80 | (code >> 6 & 0x3F);
+          utf8[3] = 0x80 | (code & 0x3F);
+          width = 4;
+        }
+        break;
+      }
+      default:
+        utf8[0] = escape;
+        break;
+      }
+    }
+    if (n + width >= EVENT_NAME_MAX)
+      break;
+    memcpy(dest + n, utf8, width);
+    n += width;
+  }
+  dest[n] = '\0';
+
+  return true;
+}
+
+static bool scan_rect(struct cursor *c, struct window_event *event) {
+  if (!expect(c, '{'))
+    return false;
+  if (expect(c, '}'))
+    return true;
+  do {
+    const char *key;
+    size_t len;
+    if (!scan_string(c, &key, &len) || !expect(c, ':'))
+      return false;
+    bool ok = KEY("x")        ? scan_int(c, &event->xcr)
+              : KEY("y")      ? scan_int(c, &event->ycr)
+              : KEY("width")  ? scan_int(c, &event->width)
+              : KEY("height") ? scan_int(c, &event->height)
+                              : skip_value(c);
+    if (!ok)
+      return false;
+  } while (expect(c, ','));
+  return expect(c, '}');
+}
+
+static bool scan_container(struct cursor *c, struct window_event *event) {
+  if (scan_literal(c, "null"))
+    return true;
+  if (!expect(c, '{'))
+    return false;
+  if (expect(c, '}'))
+    return true;
+  do {
+    const char *key;
+    size_t len;
+    if (!scan_string(c, &key, &len) || !expect(c, ':'))
+      return false;
+    bool ok;
+    if (KEY("id"))
+      ok = scan_int(c, &event->id);
+    else if (KEY("name"))
+      ok = scan_text(c, event->name, &event->named);
+    else if (KEY("rect"))
+      ok = scan_rect(c, event);
+    else if (KEY("focused"))
+      ok = (event->focused = scan_literal(c, "true")) ||
+           scan_literal(c, "false");
+    else
+      ok = skip_value(c);
+    if (!ok)
+      return false;
+  } while (expect(c, ','));
+  return expect(c, '}');
+}
+
+/* walks the payload once, descending only into the container and its rect
+ * and skipping everything else (nodes, window_properties, ...) unparsed */
+bool event_scan(const char *payload, size_t size, struct window_event *event) {
+  struct cursor c = {.p = payload, .end = payload + size};
+  memset(event, 0, offsetof(struct window_event, name));
+  event->name[0] = '\0';
+
+  if (!expect(&c, '{'))
+    return false;
+  if (expect(&c, '}'))
+    return true;
+  do {
+    const char *key, *str;
+    size_t len;
+    if (!scan_string(&c, &key, &len) || !expect(&c, ':'))
+      return false;
+    bool ok;
+    if (KEY("change")) {
+      ok = scan_string(&c, &str, &len);
+      event->change = ok ? change_lookup(str, len) : CHANGE_OTHER;
+    } else if (KEY("container")) {
+      ok = scan_container(&c, event);
+    } else {
+      ok = skip_value(&c);
+    }
+    if (!ok)
+      return false;
+  } while (expect(&c, ','));
+
+  return expect(&c, '}');
+}
+
+static bool scan_workspace(struct cursor *c, struct workspace_event *event) {
+  bool present;
+  if (scan_literal(c, "null"))
+    return true;
+  if (!expect(c, '{'))
+    return false;
+  if (expect(c, '}'))
+    return true;
+  do {
+    const char *key;
+    size_t len;
+    if (!scan_string(c, &key, &len) || !expect(c, ':'))
+      return false;
+    bool ok = KEY("name")     ? scan_text(c, event->name, &present)
+              : KEY("output") ? scan_text(c, event->output, &present)
+                              : skip_value(c);
+    if (!ok)
+      return false;
+  } while (expect(c, ','));
+  return expect(c, '}');
+}
+
+/* like event_scan, the workspace's nodes are skipped over unparsed */
+bool event_workspace_scan(const char *payload, size_t size,
+                          struct workspace_event *event) {
+  struct cursor c = {.p = payload, .end = payload + size};
+  event->change = CHANGE_OTHER;
+  event->name[0] = event->output[0] = '\0';
+
+  if (!expect(&c, '{'))
+    return false;
+  if (expect(&c, '}'))
+    return true;
+  do {
+    const char *key, *str;
+    size_t len;
+    if (!scan_string(&c, &key, &len) || !expect(&c, ':'))
+      return false;
+    bool ok;
+    if (KEY("change")) {
+      ok = scan_string(&c, &str, &len);
+      event->change = ok ? change_lookup(str, len) : CHANGE_OTHER;
+    } else if (KEY("current")) {
+      ok = scan_workspace(&c, event);
+    } else {
+      ok = skip_value(&c);
+    }
+    if (!ok)
+      return false;
+  } while (expect(&c, ','));
+
+  return expect(&c, '}');
+}
+
+bool event_json(const char *payload, size_t size, struct window_event *event) {
+  memset(event, 0, offsetof(struct window_event, name));
+  event->name[0] = '\0';
+
+  json_tokener *tok = json_tokener_new_ex(JSON_MAX_DEPTH);
+  if (tok == NULL)
+    return false;
+  json_object *obj = json_tokener_parse_ex(tok, payload, size);
+  enum json_tokener_error err = json_tokener_get_error(tok);
+  json_tokener_free(tok);
+  if (obj == NULL || err != json_tokener_success) {
+    json_object_put(obj);
+    return false;
+  }
+
+  json_object *stat, *cont, *field, *rect;
+  if (json_object_object_get_ex(obj, "change", &stat)) {
+    const char *change = json_object_get_string(stat);
+    event->change = change_lookup(change, strlen(change));
+  }
+
+  if (json_object_object_get_ex(obj, "container", &cont)) {
+    if (json_object_object_get_ex(cont, "id", &field))
+      event->id = json_object_get_int(field);
+    if (json_object_object_get_ex(cont, "focused", &field))
+      event->focused = json_object_get_boolean(field);
+    if (json_object_object_get_ex(cont, "name", &field) &&
+        json_object_is_type(field, json_type_string)) {
+      event->named = true;
+      event_text(event->name, json_object_get_string(field),
+                 json_object_get_string_len(field));
+    }
+    if (json_object_object_get_ex(cont, "rect", &rect)) {
+      if (json_object_object_get_ex(rect, "x", &field))
+        event->xcr = json_object_get_int(field);
+      if (json_object_object_get_ex(rect, "y", &field))
+        event->ycr = json_object_get_int(field);
+      if (json_object_object_get_ex(rect, "width", &field))
+        event->width = json_object_get_int(field);
+      if (json_object_object_get_ex(rect, "height", &field))
+        event->height = json_object_get_int(field);
+    }
+  }
+
+  json_object_put(obj);
+  return true;
+}
+
+bool event_workspace_json(const char *payload, size_t size,
+                          struct workspace_event *event) {
+  event->change = CHANGE_OTHER;
+  event->name[0] = event->output[0] = '\0';
+
+  json_tokener *tok = json_tokener_new_ex(JSON_MAX_DEPTH);
+  if (tok == NULL)
+    return false;
+  json_object *obj = json_tokener_parse_ex(tok, payload, size);
+  enum json_tokener_error err = json_tokener_get_error(tok);
+  json_tokener_free(tok);
+  if (obj == NULL || err != json_tokener_success) {
+    json_object_put(obj);
+    return false;
+  }
+
+  json_object *stat, *cur, *field;
+  if (json_object_object_get_ex(obj, "change", &stat)) {
+    const char *change = json_object_get_string(stat);
+    event->change = change_lookup(change, strlen(change));
+  }
+
+  if (json_object_object_get_ex(obj, "current", &cur)) {
+    if (json_object_object_get_ex(cur, "name", &field) &&
+        json_object_is_type(field, json_type_string))
+      event_text(event->name, json_object_get_string(field),
+                 json_object_get_string_len(field));
+    if (json_object_object_get_ex(cur, "output", &field) &&
+        json_object_is_type(field, json_type_string))
+      event_text(event->output, json_object_get_string(field),
+                 json_object_get_string_len(field));
+  }
+
+  json_object_put(obj);
+  return true;
+}
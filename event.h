@@ -0,0 +1,59 @@
+#ifndef EXPOSWAY_EVENT_H
+#define EXPOSWAY_EVENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define JSON_MAX_DEPTH 124
+#define EVENT_NAME_MAX 512
+
+enum event_change {
+  CHANGE_OTHER,
+  CHANGE_NEW,
+  CHANGE_CLOSE,
+  CHANGE_FOCUS,
+  CHANGE_TITLE,
+  CHANGE_FULLSCREEN_MODE,
+  CHANGE_MOVE,
+  CHANGE_FLOATING,
+  CHANGE_URGENT,
+  CHANGE_MARK,
+  CHANGE_INIT,
+  CHANGE_EMPTY,
+  CHANGE_RENAME,
+  CHANGE_RELOAD,
+  CHANGE_COUNT,
+};
+
+/* the part of a sway window event exposwayd acts on; name is the
+ * container's title, cut on a character boundary to fit */
+struct window_event {
+  enum event_change change;
+  int id;
+  bool focused;
+  bool named;
+  int xcr, ycr, width, height;
+  char name[EVENT_NAME_MAX];
+};
+
+/* the current workspace of a sway workspace event */
+struct workspace_event {
+  enum event_change change;
+  char name[EVENT_NAME_MAX];
+  char output[EVENT_NAME_MAX];
+};
+
+enum event_parser {
+  PARSER_SCAN, /* single pass over the payload, no allocation */
+  PARSER_JSON, /* full json-c document */
+};
+
+bool event_scan(const char *payload, size_t size, struct window_event *event);
+bool event_json(const char *payload, size_t size, struct window_event *event);
+bool event_workspace_scan(const char *payload, size_t size,
+                          struct workspace_event *event);
+bool event_workspace_json(const char *payload, size_t size,
+                          struct workspace_event *event);
+const char *event_change_name(enum event_change change);
+
+#endif
@@ -1,83 +1,26 @@
+#include "arena.h"
+#include "layout.h"
+#include "query.h"
+#include "render.h"
 #include "xdg-shell-client-protocol.h"
-#include <cairo/cairo.h>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <math.h>
-#include <pango/pangocairo.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
 #include <xkbcommon/xkbcommon.h>
 
-#define FRAME_CLR 16, 102, 130 /* frame color */
-#define FRAME_WDH 1.6          /* frame width */
-#define FRAME_SEP 2            /* frame seperation */
-#define TITLE_CLR 1, 1, 1      /* title font color */
-#define TITLE_SZE 12           /* title font size */
-#define DELAY_SEC 0.36         /* grim shot delay */
-#define MARGN_RTO 0.07f        /* window-margin factor */
-#define COVGT_TOL 0.2f         /* binary search tolerance */
-#define EPACK_RTO 0.9f         /* ratio of packing and display */
-#define ASSERT(condition, message)                                             \
-  do {                                                                         \
-    if (!(condition)) {                                                        \
-      fprintf(stderr, "Assertion failed: (%s), function %s, line %d.\n",       \
-              #condition, __FUNCTION__, __LINE__);                             \
-      fprintf(stderr, "Error message: %s.\n", message);                        \
-    }                                                                          \
-  } while (0)
-
-typedef struct {
-  int var1;
-  int var2;
-} tuple;
-
-struct wl_window {
-  int node;
-  int width, height;
-  int phantom_width, phantom_height;
-  int xcr, ycr;
-  float scale_factor;
-  char *title;
-};
-
-struct client_state {
-  struct wl_display *wl_display;
-  struct wl_registry *wl_registry;
-  struct wl_shm *wl_shm;
-  struct wl_compositor *wl_compositor;
-  struct wl_surface *wl_surface;
-  struct wl_seat *wl_seat;
-  struct wl_window *wl_window;
-
-  struct xdg_wm_base *xdg_wm_base;
-  struct xdg_surface *xdg_surface;
-  struct xdg_toplevel *xdg_toplevel;
-
-  struct xkb_context *xkb_context;
-  struct xkb_state *xkb_state;
-  int32_t xkb_delay;
-
-  cairo_surface_t *surface;
-  cairo_t *cr;
-
-  int display_width, display_height;
-  int window_count;
-  int window_focused;
-  bool frame_draw;
-  bool focus_changing;
-  bool focus_changed;
-  bool exit;
-  clock_t focus_changed_time;
-};
+#define DELAY_SEC 0.36 /* grim shot delay */
 
 static void randname(char *buf) {
   struct timespec ts;
@@ -346,290 +289,110 @@ static const struct wl_keyboard_listener wl_keyboard_listener = {
     .repeat_info = wl_keyboard_repeat_info,
 };
 
-int _equate(const void *window1, const void *window2) {
-  struct wl_window *win1 = (struct wl_window *)window1;
-  struct wl_window *win2 = (struct wl_window *)window2;
-
-  if (win1->height != win2->height)
-    return win2->height - win1->height;
-  if (win1->width != win2->width)
-    return win2->width - win1->width;
-  return win2->node - win1->node;
-}
-
-int _nfdh(int strip_width, struct wl_window *windows, int window_count) {
-  int current_level_height = 0, current_ycr = 0, current_xcr = 0;
-
-  for (int i = 0; i < window_count; i++) {
-    windows[i].xcr = current_xcr;
-    windows[i].ycr = current_ycr;
-    if (current_xcr + windows[i].phantom_width > strip_width) {
-      current_xcr = 0;
-      current_ycr += current_level_height;
-      current_level_height = 0;
-      windows[i].xcr = current_xcr;
-      windows[i].ycr = current_ycr;
-    }
-    current_xcr += windows[i].phantom_width;
-    if (windows[i].phantom_height > current_level_height)
-      current_level_height = windows[i].phantom_height;
-  }
-
-  return current_ycr + current_level_height;
-}
-
-void _phantom(struct client_state *state) {
-  for (int i = 0; i < state->window_count; i++) {
-    state->wl_window[i].phantom_width =
-        state->wl_window[i].width > state->display_width
-            ? state->display_width
-            : state->wl_window[i].width;
-    state->wl_window[i].phantom_height =
-        state->wl_window[i].height > state->display_height
-            ? state->display_height
-            : state->wl_window[i].height;
-    state->wl_window[i].phantom_width +=
-        2 * state->wl_window[i].phantom_width * MARGN_RTO;
-    state->wl_window[i].phantom_height +=
-        2 * state->wl_window[i].phantom_height * MARGN_RTO;
-    state->wl_window[i].scale_factor = 1;
-  }
-}
-
-tuple _pack(struct client_state *state) {
-  qsort(state->wl_window, state->window_count, sizeof(struct wl_window),
-        _equate);
-
-  const float target_ratio =
-      (float)state->display_height / (float)state->display_width;
-
-  int strip_width_min = 0, strip_width_max = 0;
-  for (int i = 0; i < state->window_count; i++) {
-    strip_width_min = fmax(strip_width_min, state->wl_window[i].width);
-    strip_width_max += state->wl_window[i].width;
-  }
-
-  tuple res;
-
-  int plmt_high = _nfdh(strip_width_min, state->wl_window, state->window_count);
-  float ratio_high = (float)plmt_high / (float)strip_width_min;
-  if (ratio_high <= target_ratio) {
-    res.var1 = strip_width_min;
-    res.var2 = plmt_high;
-    return res;
-  }
-
-  int plmt_low = _nfdh(strip_width_max, state->wl_window, state->window_count);
-  float ratio_low = (float)plmt_low / (float)strip_width_max;
-  if (ratio_low >= target_ratio) {
-    res.var1 = strip_width_max;
-    res.var2 = plmt_low;
-    return res;
-  }
-
-  while ((float)strip_width_max / (float)strip_width_min > 1 + COVGT_TOL) {
-    int strip_width = sqrt(strip_width_min * strip_width_max);
-    int plmt_bin = _nfdh(strip_width, state->wl_window, state->window_count);
-    float ratio_bin = (float)plmt_bin / (float)strip_width;
-    if (ratio_bin > target_ratio) {
-      ratio_high = ratio_bin;
-      plmt_high = plmt_bin;
-      strip_width_min = strip_width;
-    } else {
-      ratio_low = ratio_bin;
-      plmt_low = plmt_bin;
-      strip_width_max = strip_width;
-    }
-  }
-
-  if (ratio_high - target_ratio < target_ratio - ratio_low) {
-    res.var1 = strip_width_min;
-    res.var2 = plmt_high;
-  } else {
-    res.var1 = strip_width_max;
-    res.var2 = plmt_low;
-  }
-
-  res.var2 = _nfdh(res.var1, state->wl_window, state->window_count);
-
-  return res;
-}
-
-void _refine(tuple pack, struct client_state *state) {
-  float width_ratio = (float)pack.var1 / (float)state->display_width;
-  float height_ratio = (float)pack.var2 / (float)state->display_height;
-  float scale_factor = width_ratio > height_ratio
-                           ? state->display_width * EPACK_RTO / pack.var1
-                           : state->display_height * EPACK_RTO / pack.var2;
-
-  for (int i = 0, level = 0, boundary = 0, track = 0, height = 0;
-       i < state->window_count; i++) {
-    if (state->wl_window[i].ycr == level) {
-      if (state->wl_window[i].xcr + state->wl_window[i].phantom_width >
-          boundary)
-        boundary = state->wl_window[i].xcr + state->wl_window[i].phantom_width;
-      if (state->wl_window[i].phantom_height > height)
-        height = state->wl_window[i].phantom_height;
-    } else {
-      for (int j = track; j < i; j++) {
-        state->wl_window[j].xcr += (pack.var1 - boundary) * 0.5;
-        state->wl_window[j].ycr +=
-            (height - state->wl_window[j].phantom_height) * 0.5;
-      }
-      level = state->wl_window[i].ycr;
-      boundary = state->wl_window[i].xcr + state->wl_window[i].phantom_width;
-      height = state->wl_window[i].phantom_height;
-      track = i;
-    }
-    if (i == state->window_count - 1) {
-      for (int j = track; j <= i; j++) {
-        state->wl_window[j].xcr += (pack.var1 - boundary) * 0.5;
-        state->wl_window[j].ycr +=
-            (height - state->wl_window[j].phantom_height) * 0.5;
-      }
-    }
-  }
-
-  for (int i = 0; i < state->window_count; i++) {
-    state->wl_window[i].scale_factor *= scale_factor;
-    state->wl_window[i].xcr =
-        (state->display_width - pack.var1 * state->wl_window[i].scale_factor) *
-            0.5 +
-        (state->wl_window[i].xcr +
-         (state->wl_window[i].phantom_width - state->wl_window[i].width) *
-             0.5) *
-            state->wl_window[i].scale_factor;
-    state->wl_window[i].ycr =
-        state->display_height -
-        (state->display_height - pack.var2 * state->wl_window[i].scale_factor) *
-            0.5 -
-        (state->wl_window[i].ycr + state->wl_window[i].phantom_height -
-         (state->wl_window[i].phantom_height - state->wl_window[i].height) *
-             0.5) *
-            state->wl_window[i].scale_factor;
-  }
-}
-
 static void expose_layout_alloc(struct client_state *state) {
-  _phantom(state);
-  _refine(_pack(state), state);
+  struct layout layout = {
+      .wl_window = state->wl_window,
+      .window_count = state->window_count,
+      .display_width = state->display_width,
+      .display_height = state->display_height,
+  };
+  _phantom(&layout);
+  _refine(_pack(&layout), &layout);
 }
 
 static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer) {
-  wl_buffer_destroy(wl_buffer);
+  struct shm_buffer *buffer = data;
+  buffer->busy = false;
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
     .release = wl_buffer_release,
 };
 
-static void _plot(struct client_state *state, int n) {
-  char imagepath[256];
-  snprintf(imagepath, sizeof(imagepath), "%s%d.png", getenv("EXPOSWAYDIR"),
-           state->wl_window[n].node);
-
-  cairo_surface_t *image = cairo_image_surface_create_from_png(imagepath);
-  ASSERT(image != NULL, "failed to create cairo image surface");
-  cairo_save(state->cr);
-
-  cairo_translate(state->cr, state->wl_window[n].xcr, state->wl_window[n].ycr);
-  cairo_scale(state->cr, state->wl_window[n].scale_factor,
-              state->wl_window[n].scale_factor);
-
-  cairo_set_source_surface(state->cr, image, 0, 0);
-  cairo_paint(state->cr);
-
-  if (state->frame_draw && state->window_focused == n) {
-    cairo_set_source_rgb(state->cr, FRAME_CLR);
-    cairo_set_line_width(state->cr,
-                         FRAME_WDH / state->wl_window[n].scale_factor);
-    cairo_rectangle(state->cr, -FRAME_WDH / state->wl_window[n].scale_factor,
-                    -FRAME_WDH / state->wl_window[n].scale_factor,
-                    state->wl_window[state->window_focused].width +
-                        FRAME_WDH * 2 / state->wl_window[n].scale_factor,
-                    state->wl_window[state->window_focused].height +
-                        FRAME_WDH * 2 / state->wl_window[n].scale_factor);
-    cairo_stroke(state->cr);
-  }
-
-  cairo_restore(state->cr);
-  cairo_surface_destroy(image);
-}
-
-static void _title(struct client_state *state, int n) {
-  PangoFontDescription *font_description;
-  font_description = pango_font_description_new();
-  pango_font_description_set_family(font_description, "monospace");
-  pango_font_description_set_weight(font_description, PANGO_WEIGHT_NORMAL);
-  pango_font_description_set_absolute_size(font_description,
-                                           TITLE_SZE * PANGO_SCALE);
-
-  PangoLayout *layout;
-  layout = pango_cairo_create_layout(state->cr);
-  pango_layout_set_font_description(layout, font_description);
-  pango_layout_set_text(layout, state->wl_window[n].title, -1);
-
-  PangoRectangle extends;
-  pango_layout_get_pixel_extents(layout, NULL, &extends);
-
-  cairo_set_source_rgb(state->cr, TITLE_CLR);
-  cairo_move_to(
-      state->cr,
-      state->wl_window[n].xcr +
-          (state->wl_window[n].width * state->wl_window[n].scale_factor -
-           extends.width) /
-              2,
-      state->wl_window[n].ycr +
-          state->wl_window[n].height * state->wl_window[n].scale_factor +
-          extends.height / 4);
-  pango_cairo_show_layout(state->cr, layout);
-
-  g_object_unref(layout);
-  pango_font_description_free(font_description);
-}
-
-static struct wl_buffer *draw_cairo(struct client_state *state) {
+/* one shm file holding every buffer, sized for the output once */
+static bool shm_buffers_create(struct client_state *state) {
   const int width = state->display_width, height = state->display_height;
   int stride = width * 4;
-  int size = stride * height;
+  size_t frame = (size_t)stride * height;
+  size_t size = frame * SHM_BUFFERS;
 
   int fd = allocate_shm_file(size);
   if (fd == -1)
-    return NULL;
+    return false;
 
   unsigned char *data =
       mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   if (data == MAP_FAILED) {
     close(fd);
-    return NULL;
+    return false;
   }
 
   struct wl_shm_pool *pool = wl_shm_create_pool(state->wl_shm, fd, size);
   ASSERT(pool != NULL, "wl_shm_pool create failed");
 
-  struct wl_buffer *buffer = wl_shm_pool_create_buffer(
-      pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
-  ASSERT(buffer != NULL, "wl_buffer create failed");
+  for (int i = 0; i < SHM_BUFFERS; i++) {
+    struct shm_buffer *buffer = &state->shm_buffers[i];
+    buffer->wl_buffer = wl_shm_pool_create_buffer(
+        pool, i * frame, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    ASSERT(buffer->wl_buffer != NULL, "wl_buffer create failed");
+    buffer->data = data + i * frame;
+    buffer->busy = false;
+    buffer->framed = RENDER_BLANK;
+    wl_buffer_add_listener(buffer->wl_buffer, &wl_buffer_listener, buffer);
+  }
   wl_shm_pool_destroy(pool);
   close(fd);
 
-  state->surface = cairo_image_surface_create_for_data(
-      data, CAIRO_FORMAT_ARGB32, width, height, stride);
-  ASSERT(state->surface != NULL, "cairo_image_surface create failed");
-  state->cr = cairo_create(state->surface);
-
-  for (int n = 0; n < state->window_count; n++) {
-    _plot(state, n);
-    _title(state, n);
-  }
+  state->shm_data = data;
+  state->shm_size = size;
+  return true;
+}
 
-  cairo_destroy(state->cr);
-  cairo_surface_destroy(state->surface);
+static void shm_buffers_destroy(struct client_state *state) {
+  for (int i = 0; i < SHM_BUFFERS; i++)
+    if (state->shm_buffers[i].wl_buffer)
+      wl_buffer_destroy(state->shm_buffers[i].wl_buffer);
+  if (state->shm_data)
+    munmap(state->shm_data, state->shm_size);
+  memset(state->shm_buffers, 0, sizeof(state->shm_buffers));
+  state->shm_data = NULL;
+}
 
-  munmap(data, size);
+/* brings a buffer the compositor is done with up to date and commits it,
+ * damaging only what changed since the last commit; false while the
+ * compositor still holds all of them, the frame is then drawn after the
+ * next release */
+static bool draw_cairo(struct client_state *state) {
+  double begin = render_now();
+  if (!state->shm_data && !shm_buffers_create(state))
+    return false;
+
+  struct shm_buffer *buffer = NULL;
+  for (int i = 0; i < SHM_BUFFERS && !buffer; i++)
+    if (!state->shm_buffers[i].busy)
+      buffer = &state->shm_buffers[i];
+  if (!buffer)
+    return false;
+
+  double start = render_now();
+  bool rendered = render_update(state, buffer->data,
+                                state->display_width * 4, &buffer->framed);
+  double end = render_now();
+  if (!rendered)
+    return false;
+
+  struct render_rect damage[RENDER_DAMAGE];
+  int count = render_damage(state, state->shown, buffer->framed, damage);
+  wl_surface_attach(state->wl_surface, buffer->wl_buffer, 0, 0);
+  for (int i = 0; i < count; i++)
+    wl_surface_damage_buffer(state->wl_surface, damage[i].x, damage[i].y,
+                             damage[i].width, damage[i].height);
+  wl_surface_commit(state->wl_surface);
+  buffer->busy = true;
+  state->shown = buffer->framed;
 
-  wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL);
-  return buffer;
+  state->stats.commit += render_now() - begin - (end - start);
+  return true;
 }
 
 static void xdg_toplevel_configure(void *data,
@@ -661,12 +424,11 @@ static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
 
   xdg_surface_ack_configure(xdg_surface, serial);
 
-  struct wl_buffer *buffer = draw_cairo(state);
-  ASSERT(buffer != NULL, "draw_cairo failed");
-  wl_surface_attach(state->wl_surface, buffer, 0, 0);
-  wl_surface_damage(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
-
-  wl_surface_commit(state->wl_surface);
+  /* the surface may have lost its contents, all of it is damaged; with
+   * every buffer held, the main loop draws it after the next release */
+  state->shown = RENDER_BLANK;
+  if (!draw_cairo(state))
+    state->focus_changed = true;
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -716,57 +478,163 @@ static const struct wl_registry_listener wl_registry_listener = {
     .global_remove = registry_global_remove,
 };
 
+/* asks exposwayd for its windows in one round trip; returns the arena
+ * descriptor that came along with them, or -1 */
+static int query_daemon(const char *path, struct query_reply *reply,
+                        struct query_output *outputs,
+                        struct query_window *windows) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  struct query_request request = {
+      .magic = QUERY_MAGIC,
+      .version = QUERY_VERSION,
+      .type = QUERY_WINDOWS,
+  };
+  union {
+    struct cmsghdr align;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = reply, .iov_len = sizeof(*reply)};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.data,
+      .msg_controllen = sizeof(control.data),
+  };
+
+  int arena_fd = -1;
+  if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) == sizeof(request) &&
+      recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) == sizeof(*reply)) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&arena_fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  size_t output_records = reply->output_count * sizeof(*outputs);
+  size_t window_records = reply->count * sizeof(*windows);
+  if (arena_fd >= 0 &&
+      (reply->magic != QUERY_MAGIC || reply->version != QUERY_VERSION ||
+       reply->output_count > QUERY_OUTPUTS || reply->count > ARENA_SLOTS ||
+       (output_records && recv(fd, outputs, output_records, MSG_WAITALL) !=
+                              (ssize_t)output_records) ||
+       (window_records && recv(fd, windows, window_records, MSG_WAITALL) !=
+                              (ssize_t)window_records))) {
+    close(arena_fd);
+    arena_fd = -1;
+  }
+  if (arena_fd < 0)
+    reply->count = reply->output_count = 0;
+
+  close(fd);
+  return arena_fd;
+}
+
 int main(int argc, char *argv[]) {
-  ASSERT(getenv("EXPOSWAYMON") != NULL, "curcial environment variable unset");
+  const char *png = NULL, *keys = "";
+  int opt;
+  while ((opt = getopt(argc, argv, "o:k:")) != -1) {
+    switch (opt) {
+    case 'o':
+      png = optarg;
+      break;
+    case 'k':
+      keys = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-o png [-k lrud]]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
   ASSERT(getenv("EXPOSWAYDIR") != NULL, "crucial environment variable unset");
   struct client_state state = {0};
 
-  FILE *monitor = fopen(getenv("EXPOSWAYMON"), "r");
-  ASSERT(monitor != NULL, "monitor specification file open failed");
-  ASSERT(fscanf(monitor, "%d %d", &state.display_width,
-                &state.display_height) == 2,
-         "monitor specification file format incorrect");
-  fclose(monitor);
-
-  DIR *dir;
-  struct dirent *entry;
-  dir = opendir(getenv("EXPOSWAYDIR"));
-  ASSERT(dir != NULL, "snapshot directory open failed");
-
-  char line[1024], title[1024], filepath[256];
-  state.wl_window = NULL;
+  char querypath[256];
+  snprintf(querypath, sizeof(querypath), "%s%s", getenv("EXPOSWAYDIR"),
+           QUERY_FN);
+  struct query_reply reply;
+  struct query_output outputs[QUERY_OUTPUTS];
+  struct query_window *windows = calloc(ARENA_SLOTS, sizeof(*windows));
+  ASSERT(windows != NULL, "allocate memory failed");
+  int arena_fd = query_daemon(querypath, &reply, outputs, windows);
+  ASSERT(arena_fd >= 0, "exposwayd query failed");
+
+  /* exposway opens on the focused output and only shows what is on it */
+  const struct query_output *output = NULL;
+  for (uint32_t i = 0; i < reply.output_count; i++)
+    if (outputs[i].focused)
+      output = &outputs[i];
+  ASSERT(output != NULL, "focused output unknown");
+  if (output) {
+    state.display_width = output->width;
+    state.display_height = output->height;
+  }
+  struct stat arena_stat;
+  ASSERT(fstat(arena_fd, &arena_stat) == 0, "snapshot arena stat failed");
+  state.arena_size = arena_stat.st_size;
+  state.arena =
+      mmap(NULL, state.arena_size, PROT_READ, MAP_SHARED, arena_fd, 0);
+  ASSERT(state.arena != MAP_FAILED, "snapshot arena mmap failed");
+  close(arena_fd);
+
+  const struct arena_header *arena = (const struct arena_header *)state.arena;
+  ASSERT(state.arena_size >= sizeof(*arena) && arena->magic == ARENA_MAGIC &&
+             arena->version == ARENA_VERSION,
+         "snapshot arena format incorrect");
+
+  state.wl_window = calloc(ARENA_SLOTS, sizeof(*state.wl_window));
+  ASSERT(state.wl_window != NULL, "allocate memory failed");
   int numwin = 0;
-  while ((entry = readdir(dir)) != NULL) {
-    char *endptr;
-    long node = strtol(entry->d_name, &endptr, 10);
-    if (*endptr == '\0') {
-      ++numwin;
-      sprintf(filepath, "%s%s", getenv("EXPOSWAYDIR"), entry->d_name);
-      state.wl_window =
-          realloc(state.wl_window, numwin * sizeof(*state.wl_window));
-      ASSERT(state.wl_window != NULL, "reallocate memory failed");
-      struct wl_window *instance = &state.wl_window[numwin - 1];
-      instance->node = (int)node;
-      FILE *inst = fopen(filepath, "r");
-      ASSERT(inst != NULL, "instance file open failed");
-      fgets(line, sizeof(line), inst);
-      ASSERT(sscanf(line, "%*d,%*d %dx%d %[^\n]", &instance->width,
-                    &instance->height, title) == 3,
-             "instance file format incorrect");
-      instance->title = malloc(strlen(title) + 1);
-      ASSERT(instance->title != NULL,
-             "allocate memory for window title failed");
-      strcpy(instance->title, title);
-      fclose(inst);
-    }
+  for (uint32_t i = 0; i < reply.count; i++) {
+    struct query_window *window = &windows[i];
+    window->title[ARENA_TITLE - 1] = '\0';
+    if ((output && strncmp(window->output, output->name, QUERY_NAME)) ||
+        window->slot < 0 || window->slot >= ARENA_SLOTS)
+      continue;
+    struct wl_window *instance = &state.wl_window[numwin];
+    instance->node = window->node;
+    instance->slot = window->slot;
+    instance->width = window->width;
+    instance->height = window->height;
+    instance->title = window->title;
+    ++numwin;
   }
-  closedir(dir);
   state.window_count = numwin;
 
   state.frame_draw = false;
   state.window_focused = 0;
+  state.shown = RENDER_BLANK;
 
   expose_layout_alloc(&state);
+  /* thumbnails are made while the window is set up, the first frame waits
+   * for whatever is left */
+  bool loading = render_cache_start(&state, 0);
+  ASSERT(loading, "thumbnail cache failed");
+
+  /* offscreen, the frame after moving focus along keys goes to a PNG and
+   * Wayland is never touched */
+  if (png) {
+    state.frame_draw = *keys != '\0';
+    for (const char *key = keys; *key && state.window_count; key++)
+      nearest_window(&state, *key);
+    bool written = render_png(&state, png);
+    ASSERT(written, "offscreen frame write failed");
+    render_fini(&state);
+    free(windows);
+    free(state.wl_window);
+    munmap(state.arena, state.arena_size);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
   state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
   ASSERT(state.xkb_context != NULL, "xkb_context new failed");
@@ -798,19 +666,16 @@ int main(int argc, char *argv[]) {
       ASSERT(false, "wl_display dispatch failed");
       break;
     } else {
-      if (state.focus_changed) {
-        struct wl_buffer *buffer = draw_cairo(&state);
-        ASSERT(buffer != NULL, "draw_cairo failed");
-        wl_surface_attach(state.wl_surface, buffer, 0, 0);
-        wl_surface_damage(state.wl_surface, 0, 0, INT32_MAX, INT32_MAX);
-        wl_surface_commit(state.wl_surface);
-      }
+      if (state.focus_changed && draw_cairo(&state))
+        state.focus_changed = false;
     }
   }
 
-  while (numwin-- > 0)
-    free(state.wl_window[numwin].title);
+  shm_buffers_destroy(&state);
+  render_fini(&state);
+  free(windows);
   free(state.wl_window);
+  munmap(state.arena, state.arena_size);
 
   return 0;
 }
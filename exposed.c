@@ -1,23 +1,33 @@
-#include <json.h>
+#define _GNU_SOURCE
+#include "arena.h"
+#include "capture.h"
+#include "event.h"
+#include "ipc.h"
+#include "metrics.h"
+#include "pool.h"
+#include "query.h"
+#include "record.h"
+#include "registry.h"
+#include <errno.h>
+#include <ftw.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
-#define IPC_HEADER_SIZE (sizeof(ipc_magic) + 8)
 #define EXP_LOG_FN "expose.log"
-#define EXP_MON_FN "output"
-#define EXP_SUB_PL "[\"window\"]"
-#define JSON_MAX_DEPTH 124
-#define INTS_MAX_BNDRY 11
-#define SYSM_MAX_LNGTH 72
-#define event_mask(ev) (1 << (ev & 0x7F))
+#define EXP_SUB_PL "[\"window\",\"workspace\",\"output\"]"
+#define QUIET_MS_DFLT 120  /* capture once a window's events pause this long */
+#define STALE_MS_DFLT 1000 /* but never let a busy window wait longer */
+#define WORKERS_DFLT 2     /* capture threads */
+#define STATS_MS_DFLT 1000 /* how often the stats file is rewritten */
 #define log(...)                                                               \
   if (log) {                                                                   \
     struct tm tm = *localtime(&(time_t){time(NULL)});                          \
@@ -35,180 +45,359 @@
     exit(EXIT_FAILURE);                                                        \
   } while (0)
 
-bool termina;
-
-volatile sig_atomic_t stop = 0;
-
-static const char ipc_magic[] = {'i', '3', '-', 'i', 'p', 'c'};
-
-enum ipc_command_type {
-  IPC_COMMAND = 0,
-  IPC_GET_WORKSPACES = 1,
-  IPC_SUBSCRIBE = 2,
-  IPC_GET_OUTPUTS = 3,
-  IPC_GET_TREE = 4,
-  IPC_GET_MARKS = 5,
-  IPC_GET_BAR_CONFIG = 6,
-  IPC_GET_VERSION = 7,
-  IPC_GET_BINDING_MODES = 8,
-  IPC_GET_CONFIG = 9,
-  IPC_SEND_TICK = 10,
-  IPC_SYNC = 11,
-  IPC_GET_BINDING_STATE = 12,
-  IPC_GET_INPUTS = 100,
-  IPC_GET_SEATS = 101,
-  IPC_EVENT_WORKSPACE = ((1 << 31) | 0),
-  IPC_EVENT_OUTPUT = ((1 << 31) | 1),
-  IPC_EVENT_MODE = ((1 << 31) | 2),
-  IPC_EVENT_WINDOW = ((1 << 31) | 3),
-  IPC_EVENT_BARCONFIG_UPDATE = ((1 << 31) | 4),
-  IPC_EVENT_BINDING = ((1 << 31) | 5),
-  IPC_EVENT_SHUTDOWN = ((1 << 31) | 6),
-  IPC_EVENT_TICK = ((1 << 31) | 7),
-  IPC_EVENT_BAR_STATE_UPDATE = ((1 << 31) | 20),
-  IPC_EVENT_INPUT = ((1 << 31) | 21),
+const char *const backend_names[] = {
+    [CAPTURE_SCREENCOPY] = "screencopy",
+    [CAPTURE_GRIM] = "grim",
+    [CAPTURE_NULL] = "null",
 };
 
-struct ipc_response {
-  uint32_t size;
-  uint32_t type;
-  char *payload;
+/* what woke the event loop, kept in the low half of each epoll
+ * registration; query clients keep their index in the high half */
+enum source {
+  SOURCE_SWAY,
+  SOURCE_COMMAND,
+  SOURCE_POOL,
+  SOURCE_QUERY,
+  SOURCE_CLIENT,
+  SOURCE_SIGNAL,
+  SOURCE_DEBOUNCE,
+  SOURCE_STATS,
 };
 
-char *get_socketpath(void) {
-  const char *swaysock = getenv("SWAYSOCK");
-  if (swaysock)
-    return strdup(swaysock);
-  char *line = NULL;
-  size_t line_size = 0;
-  FILE *fp = popen("sway --get-socketpath 2>/dev/null", "r");
-  if (fp) {
-    ssize_t nret = getline(&line, &line_size, fp);
-    pclose(fp);
-    if (nret > 0) {
-      if (line[nret - 1] == '\n')
-        line[nret - 1] = '\0';
-      return line;
-    }
-  }
-  return NULL;
+/* a capture owed to the window in the same arena slot; events arriving
+ * while it waits only refresh its geometry */
+struct pending {
+  int node;
+  int xcr, ycr, width, height;
+  int64_t first, last;
+  bool blurred; /* lost focus, so due right away */
+};
+
+struct debounce {
+  struct pending entries[ARENA_SLOTS];
+  int quiet, stale;
+  int focused, focused_slot;
+  unsigned long requested, captured, coalesced, hidden;
+};
+
+int64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-int ipc_open_socket(const char *socket_path) {
-  struct sockaddr_un addr;
-  int socketfd;
-  if ((socketfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
-    abort("Unable to open Unix socket");
-  addr.sun_family = AF_UNIX;
-  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
-  addr.sun_path[sizeof(addr.sun_path) - 1] = 0;
-  int l = sizeof(struct sockaddr_un);
-  if (connect(socketfd, (struct sockaddr *)&addr, l) == -1)
-    abort("Unable to connect to %s", socket_path);
-  return socketfd;
+double monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void debounce_push(struct debounce *deb, int slot, int node, int xcr, int ycr,
+                   int width, int height, int64_t now) {
+  struct pending *entry = &deb->entries[slot];
+
+  deb->requested++;
+  if (entry->node == node)
+    deb->coalesced++;
+  else
+    entry->first = now;
+
+  entry->node = node;
+  entry->xcr = xcr;
+  entry->ycr = ycr;
+  entry->width = width;
+  entry->height = height;
+  entry->last = now;
+  entry->blurred = false;
 }
 
-bool ipc_set_recv_timeout(int socketfd, struct timeval tv) {
-  if (setsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+/* the focused window is losing focus: its owed capture is taken right
+ * away, while what it shows is still current, or dropped when it is
+ * hidden already and a capture would show whatever replaced it; true when
+ * dropped */
+bool debounce_blur(struct debounce *deb, bool hidden) {
+  struct pending *entry = &deb->entries[deb->focused_slot];
+  bool owed = deb->focused && entry->node == deb->focused;
+  deb->focused = 0;
+  if (!owed)
     return false;
-  return true;
+  if (hidden) {
+    entry->node = 0;
+    deb->hidden++;
+    return true;
+  }
+  entry->blurred = true;
+  return false;
 }
 
-struct ipc_response *ipc_recv_response(int socketfd) {
-  char data[IPC_HEADER_SIZE];
+int64_t debounce_deadline(struct debounce *deb, struct pending *entry) {
+  if (entry->blurred)
+    return 0;
+  int64_t quiet = entry->last + deb->quiet;
+  int64_t stale = entry->first + deb->stale;
+  return quiet < stale ? quiet : stale;
+}
 
-  size_t total = 0;
-  while (total < IPC_HEADER_SIZE) {
-    ssize_t received = recv(socketfd, data + total, IPC_HEADER_SIZE - total, 0);
-    if (received <= 0)
-      abort("Unable to receive IPC response");
-    total += received;
+/* the earliest deadline, -1 when nothing is pending */
+int64_t debounce_next(struct debounce *deb) {
+  int64_t earliest = -1;
+  for (int i = 0; i < ARENA_SLOTS; i++) {
+    if (!deb->entries[i].node)
+      continue;
+    int64_t deadline = debounce_deadline(deb, &deb->entries[i]);
+    if (earliest < 0 || deadline < earliest)
+      earliest = deadline;
   }
+  return earliest;
+}
 
-  struct ipc_response *response = malloc(sizeof(struct ipc_response));
-  if (!response)
-    goto error_1;
+/* fires once at deadline, on the monotonic clock in ms, or never when it is
+ * negative; a deadline already past fires right away */
+bool timer_arm(int fd, int64_t deadline) {
+  struct itimerspec spec = {0};
+  if (deadline >= 0) {
+    spec.it_value.tv_sec = deadline / 1000;
+    spec.it_value.tv_nsec = deadline % 1000 * 1000000;
+    if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+      spec.it_value.tv_nsec = 1;
+  }
+  return timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0;
+}
 
-  memcpy(&response->size, data + sizeof(ipc_magic), sizeof(uint32_t));
-  memcpy(&response->type, data + sizeof(ipc_magic) + sizeof(uint32_t),
-         sizeof(uint32_t));
+/* queues one capture of the focused output, cropped into every tiled window
+ * of its workspace that no floating window covers; returns how many */
+int workspace_batch(struct registry *registry, struct arena *arena,
+                    struct pool *pool, const struct registry_window *found,
+                    int found_count, int64_t now) {
+  const struct query_output *output = NULL;
+  for (int i = 0; i < registry->output_count; i++)
+    if (!strcmp(registry->outputs[i].name, registry->output))
+      output = &registry->outputs[i];
+  if (!output)
+    return 0;
+
+  struct pool_crop crops[POOL_BATCH];
+  int count = 0;
+  for (int i = 0; i < found_count && count < POOL_BATCH; i++) {
+    const struct registry_window *window = &found[i];
+    if (window->floating || window->width <= 0 || window->height <= 0 ||
+        strcmp(window->workspace, registry->workspace))
+      continue;
+
+    bool covered = false;
+    for (int j = 0; j < found_count && !covered; j++)
+      covered = found[j].floating &&
+                !strcmp(found[j].workspace, registry->workspace) &&
+                found[j].xcr < window->xcr + window->width &&
+                window->xcr < found[j].xcr + found[j].width &&
+                found[j].ycr < window->ycr + window->height &&
+                window->ycr < found[j].ycr + found[j].height;
+    if (covered)
+      continue;
+
+    pthread_mutex_lock(&pool->lock);
+    int slot = arena_lookup(arena, window->node, true);
+    if (slot >= 0)
+      arena_update(arena, slot, window->xcr, window->ycr, window->width,
+                   window->height, window->title);
+    pthread_mutex_unlock(&pool->lock);
+    if (slot < 0)
+      break;
 
-  char *payload = malloc(response->size + 1);
-  if (!payload) {
-    goto error_2;
+    registry_assign(registry, slot, window->workspace, window->output);
+    crops[count++] = (struct pool_crop){
+        .slot = slot,
+        .node = window->node,
+        .xcr = window->xcr,
+        .ycr = window->ycr,
+        .width = window->width,
+        .height = window->height,
+    };
   }
 
-  total = 0;
-  while (total < response->size) {
-    ssize_t received =
-        recv(socketfd, payload + total, response->size - total, 0);
-    if (received < 0)
-      abort("Unable to receive IPC response");
-    total += received;
-  }
-  payload[response->size] = '\0';
-  response->payload = payload;
-
-  return response;
-error_2:
-  free(response);
-error_1:
-  abort("Unable to allocate memory for IPC response");
-  return NULL;
+  if (count)
+    pool_submit_batch(pool,
+                      &(struct pool_job){
+                          .xcr = output->xcr,
+                          .ycr = output->ycr,
+                          .width = output->width,
+                          .height = output->height,
+                          .requested = now,
+                      },
+                      crops, count);
+  return count;
 }
 
-void free_ipc_response(struct ipc_response *response) {
-  free(response->payload);
-  free(response);
+/* a request over the command connection, its reply recorded alongside
+ * the events */
+bool sway_command(struct ipc_buffer *buffer, int fd, uint32_t type,
+                  struct record *record, struct ipc_frame *reply) {
+  if (!ipc_command(buffer, fd, type, "", 0, reply))
+    return false;
+  record_frame(record, reply);
+  return true;
 }
 
-char *ipc_single_command(int socketfd, uint32_t type, const char *payload,
-                         uint32_t *len) {
-  char data[IPC_HEADER_SIZE];
-  memcpy(data, ipc_magic, sizeof(ipc_magic));
-  memcpy(data + sizeof(ipc_magic), len, sizeof(*len));
-  memcpy(data + sizeof(ipc_magic) + sizeof(*len), &type, sizeof(type));
+bool loop_add(int epoll_fd, int fd, enum source source) {
+  struct epoll_event event = {.events = EPOLLIN, .data.u64 = source};
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
 
-  if (write(socketfd, data, IPC_HEADER_SIZE) == -1)
-    abort("Unable to send IPC header");
+/* a client waits for its request to come in, then for room for its reply */
+bool loop_client(int epoll_fd, struct query_client *clients, int index,
+                 int op) {
+  struct epoll_event event = {
+      .events = clients[index].reply ? EPOLLOUT : EPOLLIN,
+      .data.u64 = (uint64_t)index << 32 | SOURCE_CLIENT,
+  };
+  return epoll_ctl(epoll_fd, op, clients[index].fd, &event) == 0;
+}
 
-  if (write(socketfd, payload, *len) == -1)
-    abort("Unable to send IPC payload");
+/* a free entry for a client just accepted, or the oldest one when there
+ * is none, to be dropped for it */
+int query_vacancy(struct query_client *clients) {
+  int index = 0;
+  for (int i = 0; i < QUERY_CLIENTS; i++) {
+    if (clients[i].fd < 0)
+      return i;
+    if (clients[i].accepted < clients[index].accepted)
+      index = i;
+  }
+  return index;
+}
+
+/* hands out the next due entry and clears it */
+int debounce_pop(struct debounce *deb, int64_t now, struct pending *due) {
+  for (int i = 0; i < ARENA_SLOTS; i++) {
+    struct pending *entry = &deb->entries[i];
+    if (!entry->node || debounce_deadline(deb, entry) > now)
+      continue;
+    *due = *entry;
+    entry->node = 0;
+    deb->captured++;
+    return i;
+  }
+  return -1;
+}
 
-  struct ipc_response *resp = ipc_recv_response(socketfd);
-  char *response = resp->payload;
-  *len = resp->size;
-  free(resp);
+/* the initial captures of every visible window, taken at startup */
+struct prewarm {
+  int nodes[ARENA_SLOTS];
+  int pending, total, captured;
+  int64_t start;
+};
 
-  return response;
+/* true when node was still owed its initial capture */
+bool prewarm_settle(struct prewarm *warm, int node) {
+  for (int i = 0; i < warm->pending; i++) {
+    if (warm->nodes[i] == node) {
+      warm->nodes[i] = warm->nodes[--warm->pending];
+      return true;
+    }
+  }
+  return false;
 }
 
-void garbage_collect(int sig) { termina = 0; }
+static int cache_unlink(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  return ftw->level ? remove(path) : 0;
+}
 
-int main(int argc, char **argv) {
-  signal(SIGTERM, garbage_collect);
+/* empties the cache directory, keeping the directory itself */
+bool cache_clean(const char *dir) {
+  return nftw(dir, cache_unlink, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
 
-  termina = 1;
+int main(int argc, char **argv) {
+  int64_t launch = monotonic_ms();
   bool log = false;
+  enum capture_backend backend = CAPTURE_SCREENCOPY;
+  struct debounce debounce = {.quiet = QUIET_MS_DFLT, .stale = STALE_MS_DFLT};
+  int workers = WORKERS_DFLT;
+  int interval = STATS_MS_DFLT;
+  enum event_parser parser = PARSER_SCAN;
+  enum snapshot_format format = SNAPSHOT_ARGB32;
+  size_t budget = 0;
+  enum arena_demotion demotion = ARENA_EVICT;
+  const char *record_fn = NULL;
 
   if (getenv("EXPOSWAYDIR") == NULL)
     abort("Unset curcial environment variable");
 
-  if (argc >= 3)
-    abort("Too many arguments");
-  if (argc == 2 && !strcmp(*++argv, "-l"))
-    log = true;
-
-  int ret_code;
-  char *cache_cmd = malloc(
-      (strlen("find % -mindepth 1 -delete") + strlen(getenv("EXPOSWAYDIR"))) *
-      sizeof(char));
-  sprintf(cache_cmd, "find %s -mindepth 1 -delete", getenv("EXPOSWAYDIR"));
-  if ((ret_code = system(cache_cmd)) != 0) {
-    free(cache_cmd);
-    abort("Syscall failed with return code %d", ret_code);
+  int opt;
+  while ((opt = getopt(argc, argv, "lc:q:s:j:p:z:b:d:m:r:")) != -1) {
+    switch (opt) {
+    case 'l':
+      log = true;
+      break;
+    case 'c':
+      if (!strcmp(optarg, "screencopy"))
+        backend = CAPTURE_SCREENCOPY;
+      else if (!strcmp(optarg, "grim"))
+        backend = CAPTURE_GRIM;
+      else if (!strcmp(optarg, "null"))
+        backend = CAPTURE_NULL;
+      else
+        abort("Unknown capture backend %s", optarg);
+      break;
+    case 'q':
+      debounce.quiet = atoi(optarg);
+      break;
+    case 's':
+      debounce.stale = atoi(optarg);
+      break;
+    case 'j':
+      workers = atoi(optarg);
+      break;
+    case 'p':
+      if (!strcmp(optarg, "scan"))
+        parser = PARSER_SCAN;
+      else if (!strcmp(optarg, "json"))
+        parser = PARSER_JSON;
+      else
+        abort("Unknown event parser %s", optarg);
+      break;
+    case 'z':
+      if (!strcmp(optarg, "raw"))
+        format = SNAPSHOT_ARGB32;
+      else if (!strcmp(optarg, "qoi"))
+        format = SNAPSHOT_QOI;
+      else
+        abort("Unknown snapshot codec %s", optarg);
+      break;
+    case 'b':
+      budget = strtoul(optarg, NULL, 10) << 20;
+      break;
+    case 'd':
+      if (!strcmp(optarg, "none"))
+        demotion = ARENA_EVICT;
+      else if (!strcmp(optarg, "halve"))
+        demotion = ARENA_HALVE;
+      else if (!strcmp(optarg, "qoi"))
+        demotion = ARENA_ENCODE;
+      else
+        abort("Unknown demotion %s", optarg);
+      break;
+    case 'm':
+      interval = atoi(optarg);
+      break;
+    case 'r':
+      record_fn = optarg;
+      break;
+    default:
+      abort("Usage: %s [-l] [-c screencopy|grim|null] [-q quiet_ms] "
+            "[-s stale_ms] [-j workers] [-p scan|json] [-z raw|qoi] "
+            "[-b budget_mib] [-d none|halve|qoi] [-m stats_ms] [-r file]",
+            argv[0]);
+    }
   }
-  free(cache_cmd);
+  if (optind < argc)
+    abort("Too many arguments");
+
+  if (!cache_clean(getenv("EXPOSWAYDIR")))
+    abort("Unable to clean %s", getenv("EXPOSWAYDIR"));
 
   char *log_fn = NULL;
   FILE *log_fp = NULL;
@@ -222,176 +411,526 @@ int main(int argc, char **argv) {
 
   log("Exposway daemon initialized successfully.");
 
-  char *socket_path = get_socketpath();
+  /* signals are read off a descriptor like everything else, so shutdown
+   * does not wait for the next sway event */
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGHUP);
+  sigprocmask(SIG_BLOCK, &signals, NULL);
+  int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (signal_fd < 0)
+    abort("Unable to create signal descriptor");
+
+  struct arena arena;
+  if (!arena_open(&arena))
+    abort("Unable to create snapshot arena");
+  arena.budget = budget;
+  arena.demotion = demotion;
+
+  log("Snapshot arena with %d slots created, tiles hashed with %s.",
+      ARENA_SLOTS, tile_hasher());
+
+  char *query_fn = malloc(
+      (strlen(getenv("EXPOSWAYDIR")) + strlen(QUERY_FN) + 1) * sizeof(char));
+  strcat(strcpy(query_fn, getenv("EXPOSWAYDIR")), QUERY_FN);
+  int query_fd = query_listen(query_fn);
+  if (query_fd < 0)
+    abort("Unable to listen on %s", query_fn);
+
+  struct registry registry = {0};
+  struct query_output outputs[QUERY_OUTPUTS];
+  struct query_window *windows = malloc(ARENA_SLOTS * sizeof(*windows));
+  if (!windows)
+    abort("Unable to allocate query replies");
+  struct query_client clients[QUERY_CLIENTS];
+  for (int i = 0; i < QUERY_CLIENTS; i++)
+    clients[i] = (struct query_client){.fd = -1};
+  uint64_t accepted = 0;
+
+  log("Query socket %s listening.", query_fn);
+
+  struct metrics metrics = {.start = launch};
+  char *stats_fn = malloc(
+      (strlen(getenv("EXPOSWAYDIR")) + strlen(METRICS_FN) + 1) * sizeof(char));
+  strcat(strcpy(stats_fn, getenv("EXPOSWAYDIR")), METRICS_FN);
+
+  struct pool pool;
+  enum capture_backend requested = backend;
+  if (!pool_start(&pool, workers, &backend, &arena, format))
+    abort("Unable to start capture workers");
+  if (backend != requested)
+    log("Screencopy unavailable, falling back to grim.");
+
+  log("%d capture workers using %s ready.", pool.count,
+      backend_names[backend]);
+
+  struct record record = {0};
+  if (record_fn && !record_open(&record, record_fn))
+    abort("Unable to record to %s", record_fn);
+  if (record_fn)
+    log("Recording IPC frames to %s.", record_fn);
+
+  char *socket_path = ipc_socket_path();
   if (!socket_path)
     abort("Unable to retrieve socket path");
 
   log("Unix socket for swayWM IPC protocol retrieved.");
 
-  uint32_t type = IPC_COMMAND;
-  char *command = NULL;
-
+  /* requests go over their own connection so their replies never have to
+   * be told apart from events */
+  int command_fd = ipc_open_socket(socket_path);
   int socket_fd = ipc_open_socket(socket_path);
+  if (command_fd < 0 || socket_fd < 0)
+    abort("Unable to connect to %s", socket_path);
 
   log("Connection established.");
 
+  struct ipc_buffer ipc, command;
+  if (!ipc_buffer_init(&ipc) || !ipc_buffer_init(&command))
+    abort("Unable to allocate IPC receive buffer");
+
   struct timeval timeout = {.tv_sec = 3, .tv_usec = 0};
+  ipc_set_recv_timeout(command_fd, timeout);
   ipc_set_recv_timeout(socket_fd, timeout);
 
-  type = IPC_GET_OUTPUTS;
-  command = strdup("");
-  uint32_t len = strlen(command);
-  char *resp = ipc_single_command(socket_fd, type, command, &len);
-
-  log("Output specification request sent.");
-
-  json_tokener *tok = json_tokener_new_ex(JSON_MAX_DEPTH);
-  if (tok == NULL)
-    abort("Failed allocating json_tokener");
-  json_object *obj = json_tokener_parse_ex(tok, resp, -1);
-  enum json_tokener_error err = json_tokener_get_error(tok);
-  json_tokener_free(tok);
-  if (obj == NULL || err != json_tokener_success)
-    abort("Failed to parse payload as json: %s", json_tokener_error_desc(err));
-
-  int array_len = json_object_array_length(obj);
-  for (int i = 0; i < array_len; i++) {
-    json_object *element = json_object_array_get_idx(obj, i);
-    json_object *focused;
-
-    if (json_object_object_get_ex(element, "focused", &focused) &&
-        json_object_get_boolean(focused)) {
-      json_object *display, *geometry_width, *geometry_height;
-      json_object_object_get_ex(element, "rect", &display);
-      json_object_object_get_ex(display, "width", &geometry_width);
-      json_object_object_get_ex(display, "height", &geometry_height);
-
-      char *mon_fn =
-          malloc((strlen(getenv("EXPOSWAYDIR")) + strlen(EXP_MON_FN) + 1) *
-                 sizeof(char));
-      strcat(strcpy(mon_fn, getenv("EXPOSWAYDIR")), EXP_MON_FN);
-      FILE *mon_fp = fopen(mon_fn, "w");
-      fprintf(mon_fp, "%d %d", json_object_get_int(geometry_width),
-              json_object_get_int(geometry_height));
-      fclose(mon_fp);
-      free(mon_fn);
-    }
-  }
+  struct ipc_frame frame;
+  if (!sway_command(&command, command_fd, IPC_GET_OUTPUTS, &record, &frame) ||
+      !registry_outputs(&registry, frame.payload, frame.size))
+    abort("Unable to retrieve outputs");
+
+  for (int i = 0; i < registry.output_count; i++)
+    log("Output %s at (%d,%d) with geometry %dx%d and scale %.2f.",
+        registry.outputs[i].name, registry.outputs[i].xcr,
+        registry.outputs[i].ycr, registry.outputs[i].width,
+        registry.outputs[i].height, registry.outputs[i].scale);
 
-  log("Currently focused monitor's geometry parsed and written.");
+  if (!sway_command(&command, command_fd, IPC_GET_WORKSPACES, &record,
+                    &frame) ||
+      !registry_workspaces(&registry, frame.payload, frame.size))
+    abort("Unable to retrieve workspaces");
 
-  json_object_put(obj);
-  free(command);
-  free(resp);
+  log("Focused workspace %s on %s.", registry.workspace, registry.output);
 
-  len = strlen(EXP_SUB_PL);
-  ipc_single_command(socket_fd, IPC_SUBSCRIBE, EXP_SUB_PL, &len);
+  if (!ipc_command(&ipc, socket_fd, IPC_SUBSCRIBE, EXP_SUB_PL,
+                   strlen(EXP_SUB_PL), &frame))
+    abort("Unable to subscribe to window events");
+  record_frame(&record, &frame);
+  double filled = monotonic_us();
 
   timeout.tv_sec = 0;
   timeout.tv_usec = 0;
   ipc_set_recv_timeout(socket_fd, timeout);
 
-  do {
-    struct ipc_response *reply = ipc_recv_response(socket_fd);
-    if (!reply)
+  /* subscribed first, so nothing that happens while the tree is walked
+   * gets lost */
+  struct prewarm warm = {.start = monotonic_ms()};
+  struct registry_window *found = malloc(ARENA_SLOTS * sizeof(*found));
+  int found_count;
+  if (!found ||
+      !sway_command(&command, command_fd, IPC_GET_TREE, &record, &frame) ||
+      (found_count = registry_tree(frame.payload, frame.size, found,
+                                   ARENA_SLOTS)) < 0)
+    abort("Unable to retrieve the layout tree");
+
+  for (int i = 0; i < found_count; i++) {
+    if (found[i].width <= 0 || found[i].height <= 0)
+      continue;
+    pthread_mutex_lock(&pool.lock);
+    int slot = arena_lookup(&arena, found[i].node, true);
+    if (slot >= 0)
+      arena_update(&arena, slot, found[i].xcr, found[i].ycr, found[i].width,
+                   found[i].height, found[i].title);
+    pthread_mutex_unlock(&pool.lock);
+    if (slot < 0)
       break;
 
-    json_tokener *tok = json_tokener_new_ex(JSON_MAX_DEPTH);
-    if (tok == NULL)
-      abort("Failed allocating json_tokener");
-
-    json_object *obj = json_tokener_parse_ex(tok, reply->payload, -1);
-    enum json_tokener_error err = json_tokener_get_error(tok);
-    json_tokener_free(tok);
-    if (obj == NULL || err != json_tokener_success)
-      abort("Failed to parse payload as json: %s",
-            json_tokener_error_desc(err));
-
-    json_object *cont;
-    json_object_object_get_ex(obj, "container", &cont);
-
-    json_object *stat, *ref;
-    json_object_object_get_ex(obj, "change", &stat);
-    json_object_object_get_ex(cont, "name", &ref);
-
-    const char *title = json_object_get_string(ref);
-
-    if (title && strcmp("Sway Expose", title)) {
-      json_object *focused;
-
-      if (!strcmp("close", json_object_get_string(stat))) {
-        json_object *node;
-
-        json_object_object_get_ex(cont, "id", &node);
-        int uid = json_object_get_int(node);
-        char uuid[INTS_MAX_BNDRY];
-        snprintf(uuid, INTS_MAX_BNDRY, "%d", uid);
-
-        log("Window %d closed, deleting cache.", uid);
-
-        char *win_fn = malloc(strlen(getenv("EXPOSWAYDIR")) + strlen(uuid) + 5);
-        strcat(strcpy(win_fn, getenv("EXPOSWAYDIR")), uuid);
-        unlink(win_fn);
-        strcat(win_fn, ".png");
-        unlink(win_fn);
-        free(win_fn);
-      } else if (json_object_object_get_ex(cont, "focused", &focused) &&
-                 json_object_get_boolean(focused)) {
-        const char *state = json_object_get_string(stat);
-
-        if (!strcmp("focus", state) || !strcmp("title", state) ||
-            !strcmp("move", state) || !strcmp("fullscreen_mode", state) ||
-            !strcmp("floating", state)) {
-          json_object *node, *rect;
-          json_object *xcr, *ycr, *width, *height;
-
-          json_object_object_get_ex(cont, "id", &node);
-          int uid = json_object_get_int(node);
-          char uuid[INTS_MAX_BNDRY];
-          snprintf(uuid, INTS_MAX_BNDRY, "%d", uid);
-
-          json_object_object_get_ex(cont, "rect", &rect);
-          json_object_object_get_ex(rect, "x", &xcr);
-          json_object_object_get_ex(rect, "y", &ycr);
-          json_object_object_get_ex(rect, "width", &width);
-          json_object_object_get_ex(rect, "height", &height);
-          int x = json_object_get_int(xcr);
-          int y = json_object_get_int(ycr);
-          int wd = json_object_get_int(width);
-          int ht = json_object_get_int(height);
-
-          log("Window %d (%s) with changed mode (%s) detected, with coordinate "
-              "(%d,%d) and geometry %dx%d.",
-              uid, title, state, x, y, wd, ht);
-
-          char *win_fn =
-              malloc(strlen(getenv("EXPOSWAYDIR")) + strlen(uuid) + 1);
-          strcat(strcpy(win_fn, getenv("EXPOSWAYDIR")), uuid);
-          FILE *win_fp = fopen(win_fn, "w");
-          free(win_fn);
-          fprintf(win_fp, "%d,%d %dx%d %s", x, y, wd, ht, title);
-          fclose(win_fp);
-
-          char grim[SYSM_MAX_LNGTH];
-          snprintf(grim, SYSM_MAX_LNGTH, "grim -g \"%d,%d %dx%d\" %s%d.png", x,
-                   y, wd, ht, getenv("EXPOSWAYDIR"), uid);
-          system(grim);
+    registry_assign(&registry, slot, found[i].workspace, found[i].output);
+    warm.nodes[warm.pending++] = found[i].node;
+    pool_submit(&pool, &(struct pool_job){
+                           .slot = slot,
+                           .node = found[i].node,
+                           .xcr = found[i].xcr,
+                           .ycr = found[i].ycr,
+                           .width = found[i].width,
+                           .height = found[i].height,
+                           .requested = warm.start,
+                       });
+  }
+  warm.total = warm.pending;
+
+  log("Capturing %d visible windows, tree walked in %lld ms.", warm.total,
+      (long long)(monotonic_ms() - warm.start));
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  int debounce_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  int stats_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (epoll_fd < 0 || debounce_fd < 0 || stats_fd < 0 ||
+      !loop_add(epoll_fd, socket_fd, SOURCE_SWAY) ||
+      !loop_add(epoll_fd, command_fd, SOURCE_COMMAND) ||
+      !loop_add(epoll_fd, pool.notify_fd, SOURCE_POOL) ||
+      !loop_add(epoll_fd, query_fd, SOURCE_QUERY) ||
+      !loop_add(epoll_fd, signal_fd, SOURCE_SIGNAL) ||
+      !loop_add(epoll_fd, debounce_fd, SOURCE_DEBOUNCE) ||
+      !loop_add(epoll_fd, stats_fd, SOURCE_STATS))
+    abort("Unable to set up the event loop");
+
+  if (interval > 0) {
+    struct itimerspec spec = {
+        .it_value = {.tv_nsec = 1},
+        .it_interval = {.tv_sec = interval / 1000,
+                        .tv_nsec = interval % 1000 * 1000000},
+    };
+    if (timerfd_settime(stats_fd, 0, &spec, NULL) < 0)
+      abort("Unable to arm stats timer");
+  }
+
+  struct window_event event;
+  struct workspace_event workspace;
+  unsigned long batches = 0, frames = 0;
+  int trees_asked = 0, outputs_asked = 0; /* requests not answered yet */
+  bool running = true;
+
+  do {
+    /* everything the last fill brought in, events that trailed the
+     * subscribe reply included; each frame is timed from that fill to the
+     * end of its handling, whichever way it leaves the body */
+    int status;
+    for (; (status = ipc_next(&ipc, &frame)) > 0;
+         metrics_observe(&metrics.event, monotonic_us() - filled)) {
+      record_frame(&record, &frame);
+      frames++;
+      metrics.frames++;
+      if (frame.type == IPC_EVENT_WORKSPACE) {
+        double parse_start = monotonic_us();
+        bool parsed =
+            parser == PARSER_SCAN
+                ? event_workspace_scan(frame.payload, frame.size, &workspace)
+                : event_workspace_json(frame.payload, frame.size, &workspace);
+        if (!parsed)
+          abort("Failed to parse workspace event");
+        metrics_observe(&metrics.parse, monotonic_us() - parse_start);
+        metrics.workspace_events[workspace.change]++;
+        if (workspace.change == CHANGE_FOCUS) {
+          /* the focused window went along with its workspace when that
+           * was on the same output */
+          int blurred = debounce.focused;
+          const char *left = registry.entries[debounce.focused_slot].output;
+          if (debounce_blur(&debounce, !strcmp(left, workspace.output)))
+            log("Window %d hidden before its capture, dropped.", blurred);
+          registry_focus(&registry, workspace.name, workspace.output);
+          /* the windows to batch come with the reply */
+          if (!ipc_send(command_fd, IPC_GET_TREE, "", 0))
+            abort("Unable to retrieve the layout tree");
+          trees_asked++;
+        }
+        continue;
+      }
+      if (frame.type == IPC_EVENT_OUTPUT) {
+        metrics.output_events++;
+        /* the event only says something changed, ask for the lot */
+        if (!ipc_send(command_fd, IPC_GET_OUTPUTS, "", 0))
+          abort("Unable to retrieve outputs");
+        outputs_asked++;
+        continue;
+      }
+      if (frame.type != IPC_EVENT_WINDOW)
+        continue;
+
+      double parse_start = monotonic_us();
+      bool parsed = parser == PARSER_SCAN
+                        ? event_scan(frame.payload, frame.size, &event)
+                        : event_json(frame.payload, frame.size, &event);
+      if (!parsed)
+        abort("Failed to parse window event");
+      metrics_observe(&metrics.parse, monotonic_us() - parse_start);
+      metrics.window_events[event.change]++;
+
+      if (!event.named || !strcmp("Sway Expose", event.name))
+        continue;
+
+      int uid = event.id;
+
+      if (event.change == CHANGE_CLOSE) {
+        log("Window %d closed, releasing its slot.", uid);
+
+        pool_cancel(&pool, uid);
+        prewarm_settle(&warm, uid);
+        pthread_mutex_lock(&pool.lock);
+        int slot = arena_lookup(&arena, uid, false);
+        if (slot >= 0) {
+          debounce.entries[slot].node = 0;
+          arena_release(&arena, slot);
+          registry_forget(&registry, slot);
+          metrics.captured[slot] = 0;
+        }
+        pthread_mutex_unlock(&pool.lock);
+      } else if (!event.focused && event.change == CHANGE_MOVE) {
+        /* moved off the focused workspace, to one we cannot tell */
+        pthread_mutex_lock(&pool.lock);
+        int slot = arena_lookup(&arena, uid, false);
+        pthread_mutex_unlock(&pool.lock);
+        if (slot >= 0)
+          registry_forget(&registry, slot);
+      } else if (event.focused && (event.change == CHANGE_FOCUS ||
+                                   event.change == CHANGE_TITLE ||
+                                   event.change == CHANGE_MOVE ||
+                                   event.change == CHANGE_FULLSCREEN_MODE ||
+                                   event.change == CHANGE_FLOATING)) {
+        int x = event.xcr, y = event.ycr;
+        int wd = event.width, ht = event.height;
+
+        log("Window %d (%s) with changed mode (%s) detected, with coordinate "
+            "(%d,%d) and geometry %dx%d.",
+            uid, event.name, event_change_name(event.change), x, y, wd, ht);
+
+        pthread_mutex_lock(&pool.lock);
+        int slot = arena_lookup(&arena, uid, true);
+        if (slot >= 0) {
+          arena_update(&arena, slot, x, y, wd, ht, event.name);
+          arena_touch(&arena, slot);
+          registry_place(&registry, slot);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        if (slot >= 0) {
+          if (debounce.focused != uid)
+            debounce_blur(&debounce, false);
+          debounce.focused = uid;
+          debounce.focused_slot = slot;
+          debounce_push(&debounce, slot, uid, x, y, wd, ht, monotonic_ms());
+        } else {
+          log("Snapshot arena full, window %d ignored.", uid);
         }
       }
     }
+    if (status < 0)
+      abort("Malformed IPC frame from sway");
+
+    struct pending due;
+    int due_slot;
+    while ((due_slot = debounce_pop(&debounce, monotonic_ms(), &due)) >= 0)
+      pool_submit(&pool, &(struct pool_job){
+                             .slot = due_slot,
+                             .node = due.node,
+                             .xcr = due.xcr,
+                             .ycr = due.ycr,
+                             .width = due.width,
+                             .height = due.height,
+                             .requested = due.first,
+                         });
+
+    if (!timer_arm(debounce_fd, debounce_next(&debounce)))
+      abort("Unable to arm capture timer");
+
+    struct epoll_event events[8];
+    int ready = epoll_wait(epoll_fd, events, 8, -1);
+    if (ready < 0 && errno != EINTR)
+      abort("Unable to wait for events");
+
+    for (int e = 0; e < ready; e++) {
+      switch ((enum source)(events[e].data.u64 & UINT32_MAX)) {
+      case SOURCE_SWAY: {
+        ssize_t received = ipc_fill(&ipc, socket_fd);
+        if (received == 0)
+          abort("Sway closed the IPC connection");
+        if (received < 0 && errno != EAGAIN && errno != EINTR)
+          abort("Unable to receive IPC response");
+        filled = monotonic_us();
+        batches++;
+        metrics.received += received > 0 ? received : 0;
+        break;
+      }
+      case SOURCE_COMMAND: {
+        ssize_t received = ipc_fill(&command, command_fd);
+        if (received == 0)
+          abort("Sway closed the IPC connection");
+        if (received < 0 && errno != EAGAIN && errno != EINTR)
+          abort("Unable to receive IPC response");
+
+        /* sway answers in order, so while more of a kind are asked for
+         * the reply at hand is already out of date */
+        struct ipc_frame reply;
+        int status;
+        while ((status = ipc_next(&command, &reply)) > 0) {
+          record_frame(&record, &reply);
+          if (reply.type == IPC_GET_TREE && trees_asked) {
+            if (--trees_asked)
+              continue;
+            if ((found_count = registry_tree(reply.payload, reply.size, found,
+                                             ARENA_SLOTS)) < 0)
+              abort("Unable to retrieve the layout tree");
+            int batched = workspace_batch(&registry, &arena, &pool, found,
+                                          found_count, monotonic_ms());
+            log("Workspace %s on %s focused, %d windows queued for one "
+                "capture.",
+                registry.workspace, registry.output, batched);
+          } else if (reply.type == IPC_GET_OUTPUTS && outputs_asked) {
+            if (--outputs_asked)
+              continue;
+            if (!registry_outputs(&registry, reply.payload, reply.size))
+              abort("Unable to retrieve outputs");
+            log("Outputs changed, %d active.", registry.output_count);
+          } else {
+            abort("Unexpected IPC reply from sway");
+          }
+        }
+        if (status < 0)
+          abort("Malformed IPC frame from sway");
+        break;
+      }
+      case SOURCE_POOL: {
+        struct pool_result results[POOL_RESULTS];
+        int n = pool_reap(&pool, results, POOL_RESULTS);
+        for (int i = 0; i < n; i++) {
+          metrics_result(&metrics, &results[i], monotonic_ms());
+          log("Window %d %s in %.2f ms, %d of %d tiles changed, %zu KiB "
+              "stored %s, %lu of %lu requests coalesced.",
+              results[i].node,
+              results[i].captured
+                  ? (results[i].batched ? "cropped" : "captured")
+                  : "capture failed",
+              results[i].elapsed, results[i].dirty > 0 ? results[i].dirty : 0,
+              results[i].tiles, results[i].size / 1024,
+              results[i].format == SNAPSHOT_QOI ? "qoi" : "raw",
+              debounce.coalesced + pool.replaced, debounce.requested);
+          if (warm.pending && prewarm_settle(&warm, results[i].node)) {
+            warm.captured += results[i].captured;
+            if (!warm.pending)
+              log("Snapshot cache populated with %d of %d windows in %lld ms, "
+                  "%lld ms after launch.",
+                  warm.captured, warm.total,
+                  (long long)(monotonic_ms() - warm.start),
+                  (long long)(monotonic_ms() - launch));
+          }
+        }
+        break;
+      }
+      case SOURCE_QUERY: {
+        int client_fd;
+        while ((client_fd = query_accept(query_fd)) >= 0) {
+          int index = query_vacancy(clients);
+          if (clients[index].fd >= 0) {
+            log("Query client stalled, dropped.");
+            query_drop(&clients[index]);
+          }
+          clients[index] =
+              (struct query_client){.fd = client_fd, .accepted = ++accepted};
+          if (!loop_client(epoll_fd, clients, index, EPOLL_CTL_ADD)) {
+            log("Unable to watch query client: %s", strerror(errno));
+            query_drop(&clients[index]);
+          }
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          log("Query rejected: %s", strerror(errno));
+        break;
+      }
+      case SOURCE_CLIENT: {
+        struct query_client *client = &clients[events[e].data.u64 >> 32];
+        if (client->fd < 0) /* dropped earlier in this round */
+          break;
+        if (!client->reply) {
+          int status = query_receive(client);
+          if (status == 0)
+            break;
+          if (status < 0) {
+            log("Query rejected: %s", strerror(errno));
+            query_drop(client);
+            break;
+          }
+
+          struct query_reply reply;
+          pthread_mutex_lock(&pool.lock);
+          query_collect(&arena, &registry, &reply, outputs, windows);
+          size_t stored = arena_stored(&arena);
+          struct arena_stats stats = arena.stats;
+          pthread_mutex_unlock(&pool.lock);
+          if (!query_answer(client, &reply, outputs, windows)) {
+            log("Unable to answer query: %s", strerror(errno));
+            query_drop(client);
+            break;
+          }
+          /* what the socket does not take now goes once it has room */
+          if (!loop_client(epoll_fd, clients, client - clients,
+                           EPOLL_CTL_MOD)) {
+            log("Unable to watch query client: %s", strerror(errno));
+            query_drop(client);
+            break;
+          }
+          log("Query answered with %u windows; snapshot cache at %zu of %zu "
+              "KiB, %lu hits, %lu misses, %lu evicted, %lu demoted.",
+              reply.count, stored / 1024, budget / 1024, stats.hits,
+              stats.misses, stats.evicted, stats.demoted);
+        }
 
-    json_object_put(obj);
-
-    free_ipc_response(reply);
-  } while (termina);
+        int status = query_send(client, arena.fd);
+        if (status < 0)
+          log("Unable to answer query: %s", strerror(errno));
+        if (status != 0)
+          query_drop(client);
+        break;
+      }
+      case SOURCE_SIGNAL: {
+        struct signalfd_siginfo info;
+        if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+          log("Signal %s caught.", strsignal(info.ssi_signo));
+          running = false;
+        }
+        break;
+      }
+      case SOURCE_DEBOUNCE: {
+        /* the due captures are handed out on the way round */
+        uint64_t expirations;
+        if (read(debounce_fd, &expirations, sizeof(expirations)) < 0 &&
+            errno != EAGAIN)
+          log("Unable to read capture timer: %s", strerror(errno));
+        break;
+      }
+      case SOURCE_STATS: {
+        uint64_t expirations;
+        if (read(stats_fd, &expirations, sizeof(expirations)) < 0)
+          break;
+        int pending = 0;
+        for (int i = 0; i < ARENA_SLOTS; i++)
+          pending += debounce.entries[i].node != 0;
+        if (!metrics_write(&metrics, stats_fn, &pool, pending,
+                           monotonic_ms()))
+          log("Unable to write %s: %s", stats_fn, strerror(errno));
+        break;
+      }
+      }
+    }
+  } while (running);
 
-  log("Terminate signal caught, cleaning up.");
+  log("%lu IPC frames received in %lu reads, cleaning up.", frames, batches);
 
   if (log)
     fclose(log_fp);
 
+  record_close(&record);
+
   close(socket_fd);
+  close(command_fd);
   free(socket_path);
+  ipc_buffer_fini(&ipc);
+  ipc_buffer_fini(&command);
+  pool_stop(&pool);
+  for (int i = 0; i < QUERY_CLIENTS; i++)
+    query_drop(&clients[i]);
+  close(query_fd);
+  unlink(query_fn);
+  free(query_fn);
+  if (interval > 0)
+    unlink(stats_fn);
+  free(stats_fn);
+  free(found);
+  close(epoll_fd);
+  close(signal_fd);
+  close(debounce_fd);
+  close(stats_fd);
+  free(windows);
+  arena_close(&arena);
 
   return 0;
 }
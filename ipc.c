@@ -0,0 +1,205 @@
+#include "ipc.h"
+#include <errno.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* SWAYSOCK, then I3SOCK, then the newest sway socket of this user in the
+ * runtime directory, the way sway --get-socketpath finds it */
+char *ipc_socket_path(void) {
+  const char *env = getenv("SWAYSOCK");
+  if (!env)
+    env = getenv("I3SOCK");
+  if (env)
+    return strdup(env);
+
+  char pattern[PATH_MAX];
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  if (runtime)
+    snprintf(pattern, sizeof(pattern), "%s/sway-ipc.%u.*.sock", runtime,
+             getuid());
+  else
+    snprintf(pattern, sizeof(pattern), "/run/user/%u/sway-ipc.%u.*.sock",
+             getuid(), getuid());
+
+  glob_t matches;
+  if (glob(pattern, GLOB_NOSORT, NULL, &matches))
+    return NULL;
+
+  char *path = NULL;
+  struct timespec newest = {0};
+  for (size_t i = 0; i < matches.gl_pathc; i++) {
+    struct stat st;
+    if (stat(matches.gl_pathv[i], &st) || !S_ISSOCK(st.st_mode))
+      continue;
+    if (!path || st.st_mtim.tv_sec > newest.tv_sec ||
+        (st.st_mtim.tv_sec == newest.tv_sec &&
+         st.st_mtim.tv_nsec > newest.tv_nsec)) {
+      free(path);
+      path = strdup(matches.gl_pathv[i]);
+      newest = st.st_mtim;
+    }
+  }
+  globfree(&matches);
+  return path;
+}
+
+int ipc_open_socket(const char *socket_path) {
+  struct sockaddr_un addr;
+  int socketfd;
+  if ((socketfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    return -1;
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  addr.sun_path[sizeof(addr.sun_path) - 1] = 0;
+  if (connect(socketfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(socketfd);
+    return -1;
+  }
+  return socketfd;
+}
+
+bool ipc_set_recv_timeout(int socketfd, struct timeval tv) {
+  if (setsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+    return false;
+  return true;
+}
+
+bool ipc_buffer_init(struct ipc_buffer *buffer) {
+  buffer->data = malloc(IPC_BUFFER_SIZE);
+  buffer->capacity = buffer->data ? IPC_BUFFER_SIZE : 0;
+  buffer->start = buffer->end = 0;
+  return buffer->data != NULL;
+}
+
+static uint32_t ipc_pending_size(struct ipc_buffer *buffer) {
+  uint32_t size;
+  memcpy(&size, buffer->data + buffer->start + sizeof(IPC_MAGIC) - 1,
+         sizeof(size));
+  return size;
+}
+
+/* makes room for at least the frame being received, moving the unread
+ * bytes to the front only when the tail runs short */
+static bool ipc_reserve(struct ipc_buffer *buffer) {
+  if (buffer->start == buffer->end)
+    buffer->start = buffer->end = 0;
+
+  size_t need = IPC_HEADER_SIZE;
+  if (buffer->end - buffer->start >= IPC_HEADER_SIZE)
+    need += ipc_pending_size(buffer);
+
+  if (buffer->start && (buffer->capacity - buffer->start < need ||
+                        buffer->capacity - buffer->end < IPC_HEADER_SIZE)) {
+    memmove(buffer->data, buffer->data + buffer->start,
+            buffer->end - buffer->start);
+    buffer->end -= buffer->start;
+    buffer->start = 0;
+  }
+
+  if (need > buffer->capacity) {
+    size_t capacity = buffer->capacity;
+    while (capacity < need)
+      capacity *= 2;
+    char *data = realloc(buffer->data, capacity);
+    if (!data)
+      return false;
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+
+  return true;
+}
+
+/* one recv for whatever the socket holds; 0 when sway hung up */
+ssize_t ipc_fill(struct ipc_buffer *buffer, int socketfd) {
+  if (!ipc_reserve(buffer)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  ssize_t received;
+  do
+    received = recv(socketfd, buffer->data + buffer->end,
+                    buffer->capacity - buffer->end, 0);
+  while (received < 0 && errno == EINTR);
+  if (received > 0)
+    buffer->end += received;
+  return received;
+}
+
+/* 1 with the next complete frame, 0 when more bytes are needed, -1 when
+ * the stream is not i3-ipc */
+int ipc_next(struct ipc_buffer *buffer, struct ipc_frame *frame) {
+  size_t available = buffer->end - buffer->start;
+  if (available < IPC_HEADER_SIZE)
+    return 0;
+
+  const char *header = buffer->data + buffer->start;
+  if (memcmp(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1))
+    return -1;
+
+  memcpy(&frame->size, header + sizeof(IPC_MAGIC) - 1, sizeof(frame->size));
+  memcpy(&frame->type, header + sizeof(IPC_MAGIC) - 1 + sizeof(frame->size),
+         sizeof(frame->type));
+  if (available - IPC_HEADER_SIZE < frame->size)
+    return 0;
+
+  frame->payload = header + IPC_HEADER_SIZE;
+  buffer->start += IPC_HEADER_SIZE + frame->size;
+  return 1;
+}
+
+void ipc_buffer_fini(struct ipc_buffer *buffer) {
+  free(buffer->data);
+  memset(buffer, 0, sizeof(*buffer));
+}
+
+bool ipc_send(int socketfd, uint32_t type, const char *payload, uint32_t len) {
+  char header[IPC_HEADER_SIZE];
+  memcpy(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1);
+  memcpy(header + sizeof(IPC_MAGIC) - 1, &len, sizeof(len));
+  memcpy(header + sizeof(IPC_MAGIC) - 1 + sizeof(len), &type, sizeof(type));
+
+  struct iovec iov[] = {{.iov_base = header, .iov_len = IPC_HEADER_SIZE},
+                        {.iov_base = (char *)payload, .iov_len = len}};
+  size_t total = IPC_HEADER_SIZE + len;
+  while (total) {
+    ssize_t sent = writev(socketfd, iov, 2);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+    total -= sent;
+    for (int i = 0; i < 2; i++) {
+      size_t step =
+          (size_t)sent < iov[i].iov_len ? (size_t)sent : iov[i].iov_len;
+      iov[i].iov_base = (char *)iov[i].iov_base + step;
+      iov[i].iov_len -= step;
+      sent -= step;
+    }
+  }
+  return true;
+}
+
+/* sends a request and waits for the next frame, which must be its reply
+ * since nothing else is subscribed yet; the reply is borrowed like any
+ * other frame */
+bool ipc_command(struct ipc_buffer *buffer, int socketfd, uint32_t type,
+                 const char *payload, uint32_t len, struct ipc_frame *reply) {
+  if (!ipc_send(socketfd, type, payload, len))
+    return false;
+
+  int status;
+  while (!(status = ipc_next(buffer, reply)))
+    if (ipc_fill(buffer, socketfd) <= 0)
+      return false;
+  return status > 0 && reply->type == type;
+}
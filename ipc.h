@@ -0,0 +1,69 @@
+#ifndef EXPOSWAY_IPC_H
+#define EXPOSWAY_IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define IPC_MAGIC "i3-ipc"
+#define IPC_HEADER_SIZE (sizeof(IPC_MAGIC) - 1 + 8)
+#define IPC_BUFFER_SIZE (64 * 1024)
+
+enum ipc_command_type {
+  IPC_COMMAND = 0,
+  IPC_GET_WORKSPACES = 1,
+  IPC_SUBSCRIBE = 2,
+  IPC_GET_OUTPUTS = 3,
+  IPC_GET_TREE = 4,
+  IPC_GET_MARKS = 5,
+  IPC_GET_BAR_CONFIG = 6,
+  IPC_GET_VERSION = 7,
+  IPC_GET_BINDING_MODES = 8,
+  IPC_GET_CONFIG = 9,
+  IPC_SEND_TICK = 10,
+  IPC_SYNC = 11,
+  IPC_GET_BINDING_STATE = 12,
+  IPC_GET_INPUTS = 100,
+  IPC_GET_SEATS = 101,
+  IPC_EVENT_WORKSPACE = ((1u << 31) | 0),
+  IPC_EVENT_OUTPUT = ((1u << 31) | 1),
+  IPC_EVENT_MODE = ((1u << 31) | 2),
+  IPC_EVENT_WINDOW = ((1u << 31) | 3),
+  IPC_EVENT_BARCONFIG_UPDATE = ((1u << 31) | 4),
+  IPC_EVENT_BINDING = ((1u << 31) | 5),
+  IPC_EVENT_SHUTDOWN = ((1u << 31) | 6),
+  IPC_EVENT_TICK = ((1u << 31) | 7),
+  IPC_EVENT_BAR_STATE_UPDATE = ((1u << 31) | 20),
+  IPC_EVENT_INPUT = ((1u << 31) | 21),
+};
+
+/* a frame borrowed from the receive buffer, valid until its next fill */
+struct ipc_frame {
+  uint32_t type;
+  uint32_t size;
+  const char *payload;
+};
+
+/* bytes [start, end) have been received but not yet handed out */
+struct ipc_buffer {
+  char *data;
+  size_t capacity;
+  size_t start, end;
+};
+
+char *ipc_socket_path(void);
+int ipc_open_socket(const char *socket_path);
+bool ipc_set_recv_timeout(int socketfd, struct timeval tv);
+
+bool ipc_buffer_init(struct ipc_buffer *buffer);
+ssize_t ipc_fill(struct ipc_buffer *buffer, int socketfd);
+int ipc_next(struct ipc_buffer *buffer, struct ipc_frame *frame);
+void ipc_buffer_fini(struct ipc_buffer *buffer);
+
+bool ipc_send(int socketfd, uint32_t type, const char *payload, uint32_t len);
+bool ipc_command(struct ipc_buffer *buffer, int socketfd, uint32_t type,
+                 const char *payload, uint32_t len, struct ipc_frame *reply);
+
+#endif
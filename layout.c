@@ -0,0 +1,177 @@
+#include "layout.h"
+#include <math.h>
+#include <stdlib.h>
+
+int _equate(const void *window1, const void *window2) {
+  struct wl_window *win1 = (struct wl_window *)window1;
+  struct wl_window *win2 = (struct wl_window *)window2;
+
+  if (win1->height != win2->height)
+    return win2->height - win1->height;
+  if (win1->width != win2->width)
+    return win2->width - win1->width;
+  return win2->node - win1->node;
+}
+
+int _nfdh(int strip_width, struct wl_window *windows, int window_count) {
+  int current_level_height = 0, current_ycr = 0, current_xcr = 0;
+
+  for (int i = 0; i < window_count; i++) {
+    windows[i].xcr = current_xcr;
+    windows[i].ycr = current_ycr;
+    if (current_xcr + windows[i].phantom_width > strip_width) {
+      current_xcr = 0;
+      current_ycr += current_level_height;
+      current_level_height = 0;
+      windows[i].xcr = current_xcr;
+      windows[i].ycr = current_ycr;
+    }
+    current_xcr += windows[i].phantom_width;
+    if (windows[i].phantom_height > current_level_height)
+      current_level_height = windows[i].phantom_height;
+  }
+
+  return current_ycr + current_level_height;
+}
+
+/* _nfdh over every window of the layout, counted */
+static int _strip(struct layout *layout, int strip_width) {
+  layout->nfdh_calls++;
+  return _nfdh(strip_width, layout->wl_window, layout->window_count);
+}
+
+void _phantom(struct layout *layout) {
+  for (int i = 0; i < layout->window_count; i++) {
+    layout->wl_window[i].phantom_width =
+        layout->wl_window[i].width > layout->display_width
+            ? layout->display_width
+            : layout->wl_window[i].width;
+    layout->wl_window[i].phantom_height =
+        layout->wl_window[i].height > layout->display_height
+            ? layout->display_height
+            : layout->wl_window[i].height;
+    layout->wl_window[i].phantom_width +=
+        2 * layout->wl_window[i].phantom_width * MARGN_RTO;
+    layout->wl_window[i].phantom_height +=
+        2 * layout->wl_window[i].phantom_height * MARGN_RTO;
+    layout->wl_window[i].scale_factor = 1;
+  }
+}
+
+tuple _pack(struct layout *layout) {
+  qsort(layout->wl_window, layout->window_count, sizeof(struct wl_window),
+        _equate);
+
+  const float target_ratio =
+      (float)layout->display_height / (float)layout->display_width;
+
+  int strip_width_min = 0, strip_width_max = 0;
+  for (int i = 0; i < layout->window_count; i++) {
+    strip_width_min = fmax(strip_width_min, layout->wl_window[i].width);
+    strip_width_max += layout->wl_window[i].width;
+  }
+
+  tuple res;
+
+  int plmt_high = _strip(layout, strip_width_min);
+  float ratio_high = (float)plmt_high / (float)strip_width_min;
+  if (ratio_high <= target_ratio) {
+    res.var1 = strip_width_min;
+    res.var2 = plmt_high;
+    return res;
+  }
+
+  int plmt_low = _strip(layout, strip_width_max);
+  float ratio_low = (float)plmt_low / (float)strip_width_max;
+  if (ratio_low >= target_ratio) {
+    res.var1 = strip_width_max;
+    res.var2 = plmt_low;
+    return res;
+  }
+
+  while ((float)strip_width_max / (float)strip_width_min > 1 + COVGT_TOL) {
+    /* the product overflows an int past a few hundred windows */
+    int strip_width = sqrt((double)strip_width_min * strip_width_max);
+    int plmt_bin = _strip(layout, strip_width);
+    float ratio_bin = (float)plmt_bin / (float)strip_width;
+    if (ratio_bin > target_ratio) {
+      ratio_high = ratio_bin;
+      plmt_high = plmt_bin;
+      strip_width_min = strip_width;
+    } else {
+      ratio_low = ratio_bin;
+      plmt_low = plmt_bin;
+      strip_width_max = strip_width;
+    }
+  }
+
+  if (ratio_high - target_ratio < target_ratio - ratio_low) {
+    res.var1 = strip_width_min;
+    res.var2 = plmt_high;
+  } else {
+    res.var1 = strip_width_max;
+    res.var2 = plmt_low;
+  }
+
+  res.var2 = _strip(layout, res.var1);
+
+  return res;
+}
+
+void _refine(tuple pack, struct layout *layout) {
+  float width_ratio = (float)pack.var1 / (float)layout->display_width;
+  float height_ratio = (float)pack.var2 / (float)layout->display_height;
+  float scale_factor = width_ratio > height_ratio
+                           ? layout->display_width * EPACK_RTO / pack.var1
+                           : layout->display_height * EPACK_RTO / pack.var2;
+
+  for (int i = 0, level = 0, boundary = 0, track = 0, height = 0;
+       i < layout->window_count; i++) {
+    if (layout->wl_window[i].ycr == level) {
+      if (layout->wl_window[i].xcr + layout->wl_window[i].phantom_width >
+          boundary)
+        boundary =
+            layout->wl_window[i].xcr + layout->wl_window[i].phantom_width;
+      if (layout->wl_window[i].phantom_height > height)
+        height = layout->wl_window[i].phantom_height;
+    } else {
+      for (int j = track; j < i; j++) {
+        layout->wl_window[j].xcr += (pack.var1 - boundary) * 0.5;
+        layout->wl_window[j].ycr +=
+            (height - layout->wl_window[j].phantom_height) * 0.5;
+      }
+      level = layout->wl_window[i].ycr;
+      boundary = layout->wl_window[i].xcr + layout->wl_window[i].phantom_width;
+      height = layout->wl_window[i].phantom_height;
+      track = i;
+    }
+    if (i == layout->window_count - 1) {
+      for (int j = track; j <= i; j++) {
+        layout->wl_window[j].xcr += (pack.var1 - boundary) * 0.5;
+        layout->wl_window[j].ycr +=
+            (height - layout->wl_window[j].phantom_height) * 0.5;
+      }
+    }
+  }
+
+  for (int i = 0; i < layout->window_count; i++) {
+    layout->wl_window[i].scale_factor *= scale_factor;
+    layout->wl_window[i].xcr =
+        (layout->display_width -
+         pack.var1 * layout->wl_window[i].scale_factor) *
+            0.5 +
+        (layout->wl_window[i].xcr +
+         (layout->wl_window[i].phantom_width - layout->wl_window[i].width) *
+             0.5) *
+            layout->wl_window[i].scale_factor;
+    layout->wl_window[i].ycr =
+        layout->display_height -
+        (layout->display_height -
+         pack.var2 * layout->wl_window[i].scale_factor) *
+            0.5 -
+        (layout->wl_window[i].ycr + layout->wl_window[i].phantom_height -
+         (layout->wl_window[i].phantom_height - layout->wl_window[i].height) *
+             0.5) *
+            layout->wl_window[i].scale_factor;
+  }
+}
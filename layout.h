@@ -0,0 +1,40 @@
+#ifndef EXPOSWAY_LAYOUT_H
+#define EXPOSWAY_LAYOUT_H
+
+#include <stdint.h>
+
+#define MARGN_RTO 0.07f /* window-margin factor */
+#define COVGT_TOL 0.2f  /* binary search tolerance */
+#define EPACK_RTO 0.9f  /* ratio of packing and display */
+
+typedef struct {
+  int var1;
+  int var2;
+} tuple;
+
+struct wl_window {
+  int node;
+  int slot; /* in the arena, holding the snapshot */
+  int width, height;
+  int phantom_width, phantom_height;
+  int xcr, ycr;
+  float scale_factor;
+  char *title;
+};
+
+/* the part of the client state the layout works on, so it runs without
+ * Wayland; wl_window is sorted and placed in place */
+struct layout {
+  struct wl_window *wl_window;
+  int window_count;
+  int display_width, display_height;
+  unsigned long nfdh_calls;
+};
+
+int _equate(const void *window1, const void *window2);
+int _nfdh(int strip_width, struct wl_window *windows, int window_count);
+void _phantom(struct layout *layout);
+tuple _pack(struct layout *layout);
+void _refine(tuple pack, struct layout *layout);
+
+#endif
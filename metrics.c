@@ -0,0 +1,137 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+
+void metrics_observe(struct metrics_histogram *histogram, double us) {
+  int bucket = 0;
+  while (bucket < METRICS_BUCKETS && us > (double)(1 << bucket))
+    bucket++;
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->sum += us;
+  if (us > histogram->max)
+    histogram->max = us;
+}
+
+void metrics_result(struct metrics *metrics, const struct pool_result *result,
+                    int64_t now) {
+  if (!result->captured) {
+    metrics->failed++;
+    return;
+  }
+  metrics_observe(&metrics->capture, result->elapsed * 1e3);
+  metrics_observe(&metrics->latency, (now - result->requested) * 1e3);
+  metrics->captured[result->slot] = now;
+  if (result->dirty) {
+    metrics->changed++;
+    metrics->written += result->size;
+  } else {
+    metrics->unchanged++;
+  }
+}
+
+static void metrics_histogram(FILE *fp, const char *name,
+                              const struct metrics_histogram *histogram) {
+  uint64_t cumulative = 0;
+  fprintf(fp, "# TYPE %s histogram\n", name);
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    cumulative += histogram->buckets[i];
+    fprintf(fp, "%s_bucket{le=\"%g\"} %llu\n", name, (1 << i) / 1e6,
+            (unsigned long long)cumulative);
+  }
+  fprintf(fp, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+          (unsigned long long)histogram->count);
+  fprintf(fp, "%s_sum %g\n%s_count %llu\n%s_max %g\n", name,
+          histogram->sum / 1e6, name, (unsigned long long)histogram->count,
+          name, histogram->max / 1e6);
+}
+
+static void metrics_counter(FILE *fp, const char *name, const char *label,
+                            uint64_t value) {
+  if (label)
+    fprintf(fp, "%s{%s} %llu\n", name, label, (unsigned long long)value);
+  else
+    fprintf(fp, "%s %llu\n", name, (unsigned long long)value);
+}
+
+/* one counter per change seen at least once */
+static void metrics_changes(FILE *fp, const char *name,
+                            const uint64_t counts[CHANGE_COUNT]) {
+  char label[64];
+  for (int i = 0; i < CHANGE_COUNT; i++) {
+    if (!counts[i])
+      continue;
+    snprintf(label, sizeof(label), "change=\"%s\"", event_change_name(i));
+    metrics_counter(fp, name, label, counts[i]);
+  }
+}
+
+/* the Prometheus text format, written aside and renamed over path so a
+ * reader never sees half of it */
+bool metrics_write(const struct metrics *metrics, const char *path,
+                   struct pool *pool, int pending, int64_t now) {
+  char temp[4096];
+  if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp))
+    return false;
+  FILE *fp = fopen(temp, "w");
+  if (!fp)
+    return false;
+
+  fprintf(fp, "exposway_uptime_seconds %g\n", (now - metrics->start) / 1e3);
+  metrics_changes(fp, "exposway_window_events_total", metrics->window_events);
+  metrics_changes(fp, "exposway_workspace_events_total",
+                  metrics->workspace_events);
+  metrics_counter(fp, "exposway_output_events_total", NULL,
+                  metrics->output_events);
+  metrics_counter(fp, "exposway_ipc_frames_total", NULL, metrics->frames);
+  metrics_counter(fp, "exposway_ipc_bytes_total", NULL, metrics->received);
+
+  metrics_histogram(fp, "exposway_parse_seconds", &metrics->parse);
+  metrics_histogram(fp, "exposway_event_seconds", &metrics->event);
+  metrics_histogram(fp, "exposway_capture_seconds", &metrics->capture);
+  metrics_histogram(fp, "exposway_capture_latency_seconds",
+                    &metrics->latency);
+  metrics_counter(fp, "exposway_captures_total", "result=\"changed\"",
+                  metrics->changed);
+  metrics_counter(fp, "exposway_captures_total", "result=\"unchanged\"",
+                  metrics->unchanged);
+  metrics_counter(fp, "exposway_captures_total", "result=\"failed\"",
+                  metrics->failed);
+  metrics_counter(fp, "exposway_snapshot_bytes_written_total", NULL,
+                  metrics->written);
+  metrics_counter(fp, "exposway_debounce_pending", NULL, pending);
+
+  pthread_mutex_lock(&pool->lock);
+  struct arena *arena = pool->arena;
+  int inflight = 0;
+  for (int i = 0; i < pool->count; i++)
+    inflight += pool->workers[i].inflight != 0;
+  metrics_counter(fp, "exposway_queue_depth", NULL, pool->length);
+  metrics_counter(fp, "exposway_captures_inflight", NULL, inflight);
+  metrics_counter(fp, "exposway_queue_replaced_total", NULL, pool->replaced);
+  metrics_counter(fp, "exposway_queue_dropped_total", NULL, pool->dropped);
+  metrics_counter(fp, "exposway_cache_bytes", NULL, arena_stored(arena));
+  metrics_counter(fp, "exposway_cache_budget_bytes", NULL, arena->budget);
+  metrics_counter(fp, "exposway_cache_hits_total", NULL, arena->stats.hits);
+  metrics_counter(fp, "exposway_cache_misses_total", NULL,
+                  arena->stats.misses);
+  metrics_counter(fp, "exposway_cache_evicted_total", NULL,
+                  arena->stats.evicted);
+  metrics_counter(fp, "exposway_cache_demoted_total", NULL,
+                  arena->stats.demoted);
+  for (int i = 0; i < ARENA_SLOTS; i++) {
+    const struct arena_slot *slot = &arena->header->slots[i];
+    if (slot->node && metrics->captured[i])
+      fprintf(fp, "exposway_window_capture_age_seconds{node=\"%d\"} %g\n",
+              slot->node, (now - metrics->captured[i]) / 1e3);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  bool written = !ferror(fp);
+  written &= !fclose(fp);
+  if (!written || rename(temp, path) < 0) {
+    remove(temp);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef EXPOSWAY_METRICS_H
+#define EXPOSWAY_METRICS_H
+
+#include "event.h"
+#include "pool.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define METRICS_FN "stats"
+#define METRICS_BUCKETS 24 /* up to 1 << 23 us, about 8 s */
+
+/* bucket i counts observations of at most 1 << i microseconds, the last
+ * one everything longer */
+struct metrics_histogram {
+  uint64_t buckets[METRICS_BUCKETS + 1];
+  uint64_t count;
+  double sum, max; /* us */
+};
+
+/* owned by the event loop; what the workers know is read off the pool */
+struct metrics {
+  int64_t start; /* ms */
+  uint64_t window_events[CHANGE_COUNT];
+  uint64_t workspace_events[CHANGE_COUNT];
+  uint64_t output_events;
+  uint64_t frames, received; /* bytes */
+
+  struct metrics_histogram parse;   /* a window or workspace payload */
+  struct metrics_histogram event;   /* each frame, received to handled */
+  struct metrics_histogram capture; /* on a worker, through the commit */
+  struct metrics_histogram latency; /* first event to committed snapshot */
+
+  uint64_t changed, unchanged, failed;
+  uint64_t written; /* bytes committed to the arena */
+  int64_t captured[ARENA_SLOTS]; /* ms, 0 before the slot's first capture */
+};
+
+void metrics_observe(struct metrics_histogram *histogram, double us);
+void metrics_result(struct metrics *metrics, const struct pool_result *result,
+                    int64_t now);
+bool metrics_write(const struct metrics *metrics, const char *path,
+                   struct pool *pool, int pending, int64_t now);
+
+#endif
@@ -0,0 +1,390 @@
+#include "pool.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* whether a worker is capturing the window, alone or within a batch */
+static bool pool_capturing(struct pool *pool, int node) {
+  for (int i = 0; i < pool->count; i++) {
+    const struct pool_worker *worker = &pool->workers[i];
+    if (!worker->inflight)
+      continue;
+    for (int j = 0; j < worker->crop_count; j++)
+      if (worker->crops[j].node == node)
+        return true;
+  }
+  return false;
+}
+
+/* whether the job shares a window with one being captured, the queued
+ * batch standing for every window it is cropped into */
+static bool pool_inflight(struct pool *pool, const struct pool_job *job) {
+  if (job->node != POOL_BATCH_NODE)
+    return pool_capturing(pool, job->node);
+  for (int i = 0; i < pool->batch_count; i++)
+    if (pool_capturing(pool, pool->batch[i].node))
+      return true;
+  return false;
+}
+
+static void pool_remove(struct pool *pool, int index) {
+  for (int j = index; j > 0; j--)
+    pool->queue[(pool->head + j) % POOL_QUEUE] =
+        pool->queue[(pool->head + j - 1) % POOL_QUEUE];
+  pool->head = (pool->head + 1) % POOL_QUEUE;
+  pool->length--;
+}
+
+/* oldest queued job whose windows are not already being captured, so two
+ * workers never race on the same slot */
+static bool pool_take(struct pool *pool, struct pool_job *job) {
+  for (int i = 0; i < pool->length; i++) {
+    struct pool_job *candidate = &pool->queue[(pool->head + i) % POOL_QUEUE];
+    if (pool_inflight(pool, candidate))
+      continue;
+    *job = *candidate;
+    pool_remove(pool, i);
+    return true;
+  }
+  return false;
+}
+
+/* a worker finding the results full waits for the event loop to reap
+ * them, so none is ever lost; only once stopping is nobody left to */
+static void pool_post(struct pool *pool, const struct pool_result *result) {
+  while (pool->results_length == POOL_RESULTS && !pool->stop)
+    pthread_cond_wait(&pool->drained, &pool->lock);
+  if (pool->results_length == POOL_RESULTS)
+    return;
+  pool->results[(pool->results_head + pool->results_length++) % POOL_RESULTS] =
+      *result;
+  eventfd_write(pool->notify_fd, 1);
+}
+
+/* hashes, filters and commits one window's image, or notes that it did not
+ * change */
+static struct pool_result pool_store(struct pool_worker *worker, int slot,
+                                     int node,
+                                     const struct capture_image *image) {
+  struct pool *pool = worker->pool;
+  int tiles = tile_columns(image->width) * tile_rows(image->height);
+  int dirty = -1;
+
+  bool hashed = tiles <= worker->hashes_capacity;
+  if (!hashed) {
+    uint32_t *hashes = realloc(worker->hashes, tiles * sizeof(*hashes));
+    if (hashes) {
+      worker->hashes = hashes;
+      worker->hashes_capacity = tiles;
+      hashed = true;
+    }
+  }
+  if (hashed) {
+    tile_hash(image->data, image->width, image->height, image->stride,
+              image->invert, worker->hashes);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->arena->header->slots[slot].node == node &&
+        arena_same(pool->arena, slot, image->width, image->height,
+                   worker->hashes)) {
+      arena_touch(pool->arena, slot);
+      dirty = 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  /* the levels are filtered before taking the lock, the arena only
+   * receives a copy */
+  size_t size = hashed && dirty
+                    ? snapshot_build(&worker->snapshot,
+                                     &worker->snapshot_capacity, image->data,
+                                     image->width, image->height,
+                                     image->stride, image->invert,
+                                     worker->hashes)
+                    : 0;
+
+  /* falls back to the raw snapshot when encoding does not pay off */
+  const unsigned char *snapshot = worker->snapshot;
+  size_t encoded = size ? snapshot_encode(&worker->encoded,
+                                          &worker->encoded_capacity,
+                                          worker->snapshot, pool->format)
+                        : 0;
+  if (encoded) {
+    snapshot = worker->encoded;
+    size = encoded;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  /* the window may have closed, and its slot been reused, meanwhile */
+  if (size && pool->arena->header->slots[slot].node == node)
+    dirty = arena_commit(pool->arena, slot, snapshot, size);
+  pthread_mutex_unlock(&pool->lock);
+
+  return (struct pool_result){
+      .slot = slot,
+      .node = node,
+      .captured = dirty >= 0,
+      .tiles = tiles,
+      .dirty = dirty,
+      .format = encoded ? pool->format : SNAPSHOT_ARGB32,
+      .size = size,
+  };
+}
+
+/* the part of a batch capture showing one of its windows */
+static bool pool_crop(const struct pool_job *job, const struct pool_crop *crop,
+                      const struct capture_image *image,
+                      struct capture_image *part) {
+  /* the capture is in buffer pixels, the rectangles are logical */
+  int left = (int64_t)(crop->xcr - job->xcr) * image->width / job->width;
+  int top = (int64_t)(crop->ycr - job->ycr) * image->height / job->height;
+  int right = (int64_t)(crop->xcr + crop->width - job->xcr) * image->width /
+              job->width;
+  int bottom = (int64_t)(crop->ycr + crop->height - job->ycr) *
+               image->height / job->height;
+  left = left < 0 ? 0 : left;
+  top = top < 0 ? 0 : top;
+  right = right > image->width ? image->width : right;
+  bottom = bottom > image->height ? image->height : bottom;
+  if (right <= left || bottom <= top)
+    return false;
+
+  int row = image->invert ? image->height - bottom : top;
+  *part = (struct capture_image){
+      .data = image->data + (size_t)row * image->stride + (size_t)left * 4,
+      .width = right - left,
+      .height = bottom - top,
+      .stride = image->stride,
+      .invert = image->invert,
+  };
+  return true;
+}
+
+static double pool_elapsed(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1e3 +
+         (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void *pool_work(void *data) {
+  struct pool_worker *worker = data;
+  struct pool *pool = worker->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    struct pool_job job;
+    while (!pool->stop && !pool_take(pool, &job))
+      pthread_cond_wait(&pool->ready, &pool->lock);
+    if (pool->stop)
+      break;
+    worker->inflight = job.node;
+    /* a single window is a batch of one, given all of the capture */
+    if (job.node == POOL_BATCH_NODE) {
+      memcpy(worker->crops, pool->batch,
+             pool->batch_count * sizeof(*pool->batch));
+      worker->crop_count = pool->batch_count;
+      pool->batch_count = 0;
+    } else {
+      worker->crops[0] = (struct pool_crop){
+          .slot = job.slot,
+          .node = job.node,
+          .xcr = job.xcr,
+          .ycr = job.ycr,
+          .width = job.width,
+          .height = job.height,
+      };
+      worker->crop_count = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    struct capture_image image;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool captured = capture_window(&worker->capture, job.xcr, job.ycr,
+                                   job.width, job.height, &image);
+
+    for (int i = 0; i < worker->crop_count; i++) {
+      const struct pool_crop *crop = &worker->crops[i];
+      struct capture_image part = image;
+      bool whole = job.node != POOL_BATCH_NODE;
+      struct pool_result result = {.slot = crop->slot, .node = crop->node};
+      if (captured && (whole || pool_crop(&job, crop, &image, &part)))
+        result = pool_store(worker, crop->slot, crop->node, &part);
+      result.elapsed = pool_elapsed(&start);
+      result.requested = job.requested;
+      result.batched = job.node == POOL_BATCH_NODE;
+
+      pthread_mutex_lock(&pool->lock);
+      pool_post(pool, &result);
+      pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    worker->inflight = 0;
+    pthread_cond_broadcast(&pool->ready);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+bool pool_start(struct pool *pool, int workers, enum capture_backend *backend,
+                struct arena *arena, enum snapshot_format format) {
+  memset(pool, 0, sizeof(*pool));
+  pool->arena = arena;
+  pool->format = format;
+  if (workers < 1)
+    workers = 1;
+  if (workers > POOL_MAX_WORKERS)
+    workers = POOL_MAX_WORKERS;
+
+  pool->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (pool->notify_fd < 0)
+    return false;
+
+  for (int i = 0; i < workers; i++) {
+    if (!capture_init(&pool->workers[i].capture, *backend)) {
+      if (i == 0 && *backend == CAPTURE_SCREENCOPY) {
+        *backend = CAPTURE_GRIM;
+        i--;
+        continue;
+      }
+      pool_stop(pool);
+      return false;
+    }
+    pool->workers[i].pool = pool;
+    pool->count = i + 1;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->ready, NULL);
+  pthread_cond_init(&pool->drained, NULL);
+
+  /* signals are left to the thread running the event loop */
+  sigset_t mask, saved;
+  sigfillset(&mask);
+  pthread_sigmask(SIG_SETMASK, &mask, &saved);
+  for (int i = 0; i < pool->count; i++)
+    pthread_create(&pool->workers[i].thread, NULL, pool_work,
+                   &pool->workers[i]);
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+  return true;
+}
+
+/* a window already waiting in the queue has its job replaced, so bursts
+ * cost one capture; a full queue sheds its oldest job */
+static void pool_queue(struct pool *pool, const struct pool_job *job) {
+  bool queued = false;
+  for (int i = 0; i < pool->length; i++) {
+    struct pool_job *entry = &pool->queue[(pool->head + i) % POOL_QUEUE];
+    if (entry->node == job->node) {
+      int64_t requested = entry->requested;
+      *entry = *job;
+      if (requested < entry->requested)
+        entry->requested = requested;
+      pool->replaced++;
+      queued = true;
+      break;
+    }
+  }
+
+  if (!queued) {
+    if (pool->length == POOL_QUEUE) {
+      pool_remove(pool, 0);
+      pool->dropped++;
+    }
+    pool->queue[(pool->head + pool->length++) % POOL_QUEUE] = *job;
+  }
+
+  pthread_cond_signal(&pool->ready);
+}
+
+void pool_submit(struct pool *pool, const struct pool_job *job) {
+  pthread_mutex_lock(&pool->lock);
+  pool_queue(pool, job);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* one capture of the job's rectangle, cropped into each window; a batch
+ * still queued is replaced, the latest layout being the one on screen */
+void pool_submit_batch(struct pool *pool, const struct pool_job *job,
+                       const struct pool_crop *crops, int count) {
+  if (count > POOL_BATCH)
+    count = POOL_BATCH;
+
+  pthread_mutex_lock(&pool->lock);
+  memcpy(pool->batch, crops, count * sizeof(*crops));
+  pool->batch_count = count;
+  struct pool_job batch = *job;
+  batch.node = POOL_BATCH_NODE;
+  pool_queue(pool, &batch);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* the window is taken out of the queued batch too, which goes once no
+ * window is left in it */
+void pool_cancel(struct pool *pool, int node) {
+  pthread_mutex_lock(&pool->lock);
+  for (int i = 0; i < pool->batch_count; i++) {
+    if (pool->batch[i].node == node) {
+      pool->batch_count--;
+      memmove(&pool->batch[i], &pool->batch[i + 1],
+              (pool->batch_count - i) * sizeof(*pool->batch));
+      break;
+    }
+  }
+  for (int i = 0; i < pool->length; i++) {
+    int queued = pool->queue[(pool->head + i) % POOL_QUEUE].node;
+    if (queued == node || (queued == POOL_BATCH_NODE && !pool->batch_count))
+      pool_remove(pool, i--);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_reap(struct pool *pool, struct pool_result *results, int max) {
+  eventfd_t count;
+  eventfd_read(pool->notify_fd, &count);
+
+  pthread_mutex_lock(&pool->lock);
+  int n = 0;
+  while (n < max && pool->results_length) {
+    results[n++] = pool->results[pool->results_head];
+    pool->results_head = (pool->results_head + 1) % POOL_RESULTS;
+    pool->results_length--;
+  }
+  if (n)
+    pthread_cond_broadcast(&pool->drained);
+  pthread_mutex_unlock(&pool->lock);
+
+  return n;
+}
+
+void pool_stop(struct pool *pool) {
+  if (pool->count && pool->workers[0].thread) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_cond_broadcast(&pool->drained);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->count; i++)
+      pthread_join(pool->workers[i].thread, NULL);
+    pthread_cond_destroy(&pool->ready);
+    pthread_cond_destroy(&pool->drained);
+    pthread_mutex_destroy(&pool->lock);
+  }
+
+  for (int i = 0; i < pool->count; i++) {
+    capture_fini(&pool->workers[i].capture);
+    free(pool->workers[i].snapshot);
+    free(pool->workers[i].hashes);
+    free(pool->workers[i].encoded);
+  }
+  if (pool->notify_fd >= 0)
+    close(pool->notify_fd);
+  pool->count = 0;
+  pool->notify_fd = -1;
+}
@@ -0,0 +1,92 @@
+#ifndef EXPOSWAY_POOL_H
+#define EXPOSWAY_POOL_H
+
+#include "arena.h"
+#include "capture.h"
+#include "snapshot.h"
+#include "tile.h"
+#include <pthread.h>
+
+#define POOL_MAX_WORKERS 8
+#define POOL_QUEUE ARENA_SLOTS /* one job per window at most */
+#define POOL_RESULTS 64
+#define POOL_BATCH 32        /* windows one capture can be cropped into */
+#define POOL_BATCH_NODE (-1) /* stands for the batch in the queue */
+
+struct pool_job {
+  int slot;
+  int node;
+  int xcr, ycr, width, height;
+  int64_t requested; /* ms, when the first event asked for it */
+};
+
+/* a window within the rectangle of a batch job */
+struct pool_crop {
+  int slot;
+  int node;
+  int xcr, ycr, width, height;
+};
+
+struct pool_result {
+  int slot;
+  int node;
+  bool captured;
+  int tiles, dirty; /* dirty is 0 when the window looked just the same */
+  enum snapshot_format format;
+  size_t size; /* bytes stored, 0 when nothing was */
+  double elapsed; /* ms */
+  int64_t requested;
+  bool batched; /* cropped out of a capture shared with other windows */
+};
+
+struct pool_worker {
+  struct pool *pool;
+  pthread_t thread;
+  struct capture capture;
+  int inflight; /* node being captured, 0 when idle */
+  unsigned char *snapshot; /* the last capture, laid out with its levels */
+  size_t snapshot_capacity;
+  unsigned char *encoded; /* the same, in the pool's format */
+  size_t encoded_capacity;
+  uint32_t *hashes; /* of the last capture's tiles */
+  int hashes_capacity;
+  struct pool_crop crops[POOL_BATCH]; /* of the batch being captured */
+  int crop_count;
+};
+
+/* captures run on the workers, each with its own capture context; lock
+ * guards the queue, the results and the arena, which the workers commit
+ * finished captures to */
+struct pool {
+  struct pool_worker workers[POOL_MAX_WORKERS];
+  int count;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  bool stop;
+
+  struct pool_job queue[POOL_QUEUE];
+  int head, length;
+  struct pool_crop batch[POOL_BATCH]; /* of the batch job queued, if any */
+  int batch_count;
+
+  struct pool_result results[POOL_RESULTS];
+  int results_head, results_length;
+  pthread_cond_t drained; /* results were reaped, workers may post again */
+  int notify_fd;
+
+  struct arena *arena;
+  enum snapshot_format format; /* snapshots are stored in when it pays off */
+  unsigned long replaced, dropped;
+};
+
+bool pool_start(struct pool *pool, int workers, enum capture_backend *backend,
+                struct arena *arena, enum snapshot_format format);
+void pool_submit(struct pool *pool, const struct pool_job *job);
+void pool_submit_batch(struct pool *pool, const struct pool_job *job,
+                       const struct pool_crop *crops, int count);
+void pool_cancel(struct pool *pool, int node);
+int pool_reap(struct pool *pool, struct pool_result *results, int max);
+void pool_stop(struct pool *pool);
+
+#endif
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include "query.h"
+#include "registry.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int query_listen(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, 8) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* the pending client, its socket non-blocking like the listening one, or
+ * -1 once there is none */
+int query_accept(int listen_fd) {
+  return accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+/* reads what has arrived of the request; 1 once all of it is in and
+ * valid, 0 while more is to come, -1 when the client is to be dropped */
+int query_receive(struct query_client *client) {
+  while (client->received < sizeof(client->request)) {
+    ssize_t received =
+        recv(client->fd, (char *)&client->request + client->received,
+             sizeof(client->request) - client->received, 0);
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    if (received <= 0) {
+      if (received == 0)
+        errno = ECONNRESET;
+      return -1;
+    }
+    client->received += received;
+  }
+
+  if (client->request.magic != QUERY_MAGIC ||
+      client->request.version != QUERY_VERSION ||
+      client->request.type != QUERY_WINDOWS) {
+    errno = EPROTO;
+    return -1;
+  }
+  return 1;
+}
+
+/* a copy of every output and every window with a known geometry, taken
+ * with the arena locked so the records match the mapping the client is
+ * about to get */
+int query_collect(struct arena *arena, struct registry *registry,
+                  struct query_reply *reply, struct query_output *outputs,
+                  struct query_window *windows) {
+  for (int i = 0; i < registry->output_count; i++) {
+    outputs[i] = registry->outputs[i];
+    outputs[i].focused = !strcmp(outputs[i].name, registry->output);
+  }
+
+  int count = 0;
+  for (int i = 0; i < ARENA_SLOTS; i++) {
+    const struct arena_slot *slot = &arena->header->slots[i];
+    if (!slot->node || slot->width <= 0 || slot->height <= 0)
+      continue;
+    if (slot->offset)
+      arena->stats.hits++;
+    else
+      arena->stats.misses++;
+    struct query_window *window = &windows[count++];
+    *window = (struct query_window){
+        .node = slot->node,
+        .slot = i,
+        .xcr = slot->xcr,
+        .ycr = slot->ycr,
+        .width = slot->width,
+        .height = slot->height,
+        .offset = slot->offset,
+        .generation = slot->generation,
+    };
+    memcpy(window->title, slot->title, ARENA_TITLE);
+    memcpy(window->workspace, registry->entries[i].workspace, QUERY_NAME);
+
+    /* windows on hidden workspaces keep their output's coordinates, so
+     * the geometry tells even after a move sway did not report */
+    const char *output = registry_locate(registry, slot->xcr, slot->ycr,
+                                         slot->width, slot->height);
+    memcpy(window->output, output ? output : registry->entries[i].output,
+           QUERY_NAME);
+  }
+
+  *reply = (struct query_reply){
+      .magic = QUERY_MAGIC,
+      .version = QUERY_VERSION,
+      .count = count,
+      .output_count = registry->output_count,
+      .arena_size = arena->size,
+  };
+  return count;
+}
+
+/* lays the reply out for query_send, which may take several rounds */
+bool query_answer(struct query_client *client, const struct query_reply *reply,
+                  const struct query_output *outputs,
+                  const struct query_window *windows) {
+  size_t output_records = reply->output_count * sizeof(*outputs);
+  size_t window_records = reply->count * sizeof(*windows);
+  client->length = sizeof(*reply) + output_records + window_records;
+  client->sent = 0;
+  client->reply = malloc(client->length);
+  if (!client->reply)
+    return false;
+
+  memcpy(client->reply, reply, sizeof(*reply));
+  memcpy(client->reply + sizeof(*reply), outputs, output_records);
+  memcpy(client->reply + sizeof(*reply) + output_records, windows,
+         window_records);
+  return true;
+}
+
+/* writes as much of the reply as the socket takes, the arena descriptor
+ * going out with its first byte; 1 once all of it is out, 0 while the
+ * socket is full, -1 when the client is to be dropped */
+int query_send(struct query_client *client, int arena_fd) {
+  while (client->sent < client->length) {
+    union {
+      struct cmsghdr align;
+      char data[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {
+        .iov_base = client->reply + client->sent,
+        .iov_len = client->length - client->sent,
+    };
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (!client->sent) {
+      msg.msg_control = control.data;
+      msg.msg_controllen = sizeof(control.data);
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &arena_fd, sizeof(int));
+    }
+
+    ssize_t sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    if (sent <= 0)
+      return -1;
+    client->sent += sent;
+  }
+  return 1;
+}
+
+void query_drop(struct query_client *client) {
+  if (client->fd >= 0)
+    close(client->fd);
+  free(client->reply);
+  *client = (struct query_client){.fd = -1};
+}
@@ -0,0 +1,83 @@
+#ifndef EXPOSWAY_QUERY_H
+#define EXPOSWAY_QUERY_H
+
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define QUERY_FN "query"
+#define QUERY_MAGIC 0x51505845 /* "EXPQ" */
+#define QUERY_VERSION 2
+#define QUERY_NAME 64
+#define QUERY_OUTPUTS 16
+#define QUERY_CLIENTS 8 /* answered at once */
+
+enum query_type {
+  QUERY_WINDOWS = 1,
+};
+
+struct query_request {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t type;
+  uint32_t reserved;
+};
+
+/* answered with this header, carrying the arena descriptor as SCM_RIGHTS,
+ * followed by output_count output records and count window records */
+struct query_reply {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t output_count;
+  uint64_t arena_size;
+};
+
+/* geometry in the layout's logical coordinates, like window geometry */
+struct query_output {
+  char name[QUERY_NAME];
+  int32_t xcr, ycr;
+  int32_t width, height;
+  double scale;
+  uint32_t focused;
+  uint32_t reserved;
+};
+
+struct query_window {
+  int32_t node;
+  int32_t slot;
+  int32_t xcr, ycr;
+  int32_t width, height;
+  uint64_t offset; /* of the snapshot in the arena, 0 before the first one */
+  uint64_t generation;
+  char title[ARENA_TITLE];
+  char workspace[QUERY_NAME]; /* empty when unknown */
+  char output[QUERY_NAME];    /* the one holding the window's center */
+};
+
+/* a client in the daemon's event loop; its request is read and its reply
+ * written as the socket allows, so one that stalls holds up no other */
+struct query_client {
+  int fd;            /* -1 when unused */
+  uint64_t accepted; /* order of arrival, the oldest makes way when full */
+  struct query_request request;
+  size_t received;
+  unsigned char *reply; /* once the request is in */
+  size_t length, sent;
+};
+
+struct registry;
+
+int query_listen(const char *path);
+int query_accept(int listen_fd);
+int query_receive(struct query_client *client);
+int query_collect(struct arena *arena, struct registry *registry,
+                  struct query_reply *reply, struct query_output *outputs,
+                  struct query_window *windows);
+bool query_answer(struct query_client *client, const struct query_reply *reply,
+                  const struct query_output *outputs,
+                  const struct query_window *windows);
+int query_send(struct query_client *client, int arena_fd);
+void query_drop(struct query_client *client);
+
+#endif
@@ -0,0 +1,106 @@
+#include "record.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int64_t record_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool record_open(struct record *record, const char *path) {
+  record->fp = fopen(path, "wb");
+  if (!record->fp)
+    return false;
+  record->start = record_now();
+  if (fwrite(RECORD_MAGIC, 1, sizeof(RECORD_MAGIC) - 1, record->fp) !=
+      sizeof(RECORD_MAGIC) - 1) {
+    record_close(record);
+    return false;
+  }
+  return true;
+}
+
+/* buffered by stdio, so recording costs the event loop no syscall per
+ * frame */
+void record_frame(struct record *record, const struct ipc_frame *frame) {
+  if (!record->fp)
+    return;
+
+  char header[sizeof(uint64_t) + IPC_HEADER_SIZE];
+  uint64_t time = record_now() - record->start;
+  memcpy(header, &time, sizeof(time));
+  memcpy(header + sizeof(time), IPC_MAGIC, sizeof(IPC_MAGIC) - 1);
+  memcpy(header + sizeof(time) + sizeof(IPC_MAGIC) - 1, &frame->size,
+         sizeof(frame->size));
+  memcpy(header + sizeof(time) + sizeof(IPC_MAGIC) - 1 + sizeof(frame->size),
+         &frame->type, sizeof(frame->type));
+  fwrite(header, 1, sizeof(header), record->fp);
+  fwrite(frame->payload, 1, frame->size, record->fp);
+}
+
+void record_close(struct record *record) {
+  if (record->fp)
+    fclose(record->fp);
+  record->fp = NULL;
+}
+
+/* reads a recording, or a file of bare i3-ipc frames as captured off the
+ * sway socket by other means; returns how many frames, -1 when the file
+ * cannot be read */
+int record_load(const char *path, struct record_entry **entries) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return -1;
+
+  char magic[sizeof(RECORD_MAGIC) - 1];
+  bool timed = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+               !memcmp(magic, RECORD_MAGIC, sizeof(magic));
+  if (!timed)
+    rewind(fp);
+
+  int count = 0, capacity = 0;
+  *entries = NULL;
+  for (;;) {
+    struct record_entry entry = {0};
+    char header[IPC_HEADER_SIZE];
+    if ((timed && fread(&entry.time, sizeof(entry.time), 1, fp) != 1) ||
+        fread(header, 1, IPC_HEADER_SIZE, fp) != IPC_HEADER_SIZE ||
+        memcmp(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1))
+      break;
+    memcpy(&entry.size, header + sizeof(IPC_MAGIC) - 1, sizeof(entry.size));
+    memcpy(&entry.type, header + sizeof(IPC_MAGIC) - 1 + sizeof(entry.size),
+           sizeof(entry.type));
+
+    entry.payload = malloc(entry.size + 1);
+    if (!entry.payload)
+      break;
+    if (fread(entry.payload, 1, entry.size, fp) != entry.size) {
+      free(entry.payload);
+      break;
+    }
+    entry.payload[entry.size] = '\0';
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      struct record_entry *grown =
+          realloc(*entries, capacity * sizeof(**entries));
+      if (!grown) {
+        free(entry.payload);
+        break;
+      }
+      *entries = grown;
+    }
+    (*entries)[count++] = entry;
+  }
+
+  fclose(fp);
+  return count;
+}
+
+void record_free(struct record_entry *entries, int count) {
+  for (int i = 0; i < count; i++)
+    free(entries[i].payload);
+  free(entries);
+}
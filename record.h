@@ -0,0 +1,35 @@
+#ifndef EXPOSWAY_RECORD_H
+#define EXPOSWAY_RECORD_H
+
+#include "ipc.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RECORD_MAGIC "EXPREC01"
+
+/* a recording starts with RECORD_MAGIC, then each frame as it came off
+ * either sway connection: the microseconds since the recording started,
+ * followed by the i3-ipc frame itself, header and all; events carry the
+ * event bit in their type, command replies do not */
+struct record {
+  FILE *fp;      /* NULL when not recording */
+  int64_t start; /* us */
+};
+
+/* a frame read back; payload is NUL-terminated */
+struct record_entry {
+  uint64_t time; /* us, 0 throughout for a file of bare frames */
+  uint32_t type;
+  uint32_t size;
+  char *payload;
+};
+
+bool record_open(struct record *record, const char *path);
+void record_frame(struct record *record, const struct ipc_frame *frame);
+void record_close(struct record *record);
+
+int record_load(const char *path, struct record_entry **entries);
+void record_free(struct record_entry *entries, int count);
+
+#endif
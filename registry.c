@@ -0,0 +1,208 @@
+#include "registry.h"
+#include "event.h"
+#include <json.h>
+#include <string.h>
+
+/* copies as much of a UTF-8 string as fits, never splitting a character */
+static void registry_copy(char *dest, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (len >= size) {
+    len = size - 1;
+    while (len > 0 && (src[len] & 0xC0) == 0x80)
+      len--;
+  }
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+}
+
+void registry_focus(struct registry *registry, const char *workspace,
+                    const char *output) {
+  registry_copy(registry->workspace, workspace, QUERY_NAME);
+  registry_copy(registry->output, output, QUERY_NAME);
+}
+
+void registry_place(struct registry *registry, int slot) {
+  registry_assign(registry, slot, registry->workspace, registry->output);
+}
+
+void registry_assign(struct registry *registry, int slot,
+                     const char *workspace, const char *output) {
+  registry_copy(registry->entries[slot].workspace, workspace, QUERY_NAME);
+  registry_copy(registry->entries[slot].output, output, QUERY_NAME);
+}
+
+void registry_forget(struct registry *registry, int slot) {
+  memset(&registry->entries[slot], 0, sizeof(registry->entries[slot]));
+}
+
+/* the output holding the center of a rectangle, NULL when none does */
+const char *registry_locate(struct registry *registry, int xcr, int ycr,
+                            int width, int height) {
+  int x = xcr + width / 2, y = ycr + height / 2;
+  for (int i = 0; i < registry->output_count; i++) {
+    struct query_output *output = &registry->outputs[i];
+    if (x >= output->xcr && x < output->xcr + output->width &&
+        y >= output->ycr && y < output->ycr + output->height)
+      return output->name;
+  }
+  return NULL;
+}
+
+static json_object *registry_parse(const char *payload, size_t size) {
+  json_tokener *tok = json_tokener_new_ex(JSON_MAX_DEPTH);
+  if (tok == NULL)
+    return NULL;
+  json_object *obj = json_tokener_parse_ex(tok, payload, size);
+  enum json_tokener_error err = json_tokener_get_error(tok);
+  json_tokener_free(tok);
+  if (obj != NULL && (err != json_tokener_success ||
+                      !json_object_is_type(obj, json_type_array))) {
+    json_object_put(obj);
+    return NULL;
+  }
+  return obj;
+}
+
+/* replaces the outputs with the active ones in a GET_OUTPUTS reply */
+bool registry_outputs(struct registry *registry, const char *payload,
+                      size_t size) {
+  json_object *obj = registry_parse(payload, size);
+  if (obj == NULL)
+    return false;
+
+  registry->output_count = 0;
+  int array_len = json_object_array_length(obj);
+  for (int i = 0; i < array_len && registry->output_count < QUERY_OUTPUTS;
+       i++) {
+    json_object *element = json_object_array_get_idx(obj, i);
+    json_object *active, *name, *rect, *scale, *focused, *field;
+
+    if (!json_object_object_get_ex(element, "active", &active) ||
+        !json_object_get_boolean(active) ||
+        !json_object_object_get_ex(element, "name", &name) ||
+        !json_object_object_get_ex(element, "rect", &rect))
+      continue;
+
+    struct query_output *output =
+        &registry->outputs[registry->output_count++];
+    memset(output, 0, sizeof(*output));
+    registry_copy(output->name, json_object_get_string(name), QUERY_NAME);
+    if (json_object_object_get_ex(rect, "x", &field))
+      output->xcr = json_object_get_int(field);
+    if (json_object_object_get_ex(rect, "y", &field))
+      output->ycr = json_object_get_int(field);
+    if (json_object_object_get_ex(rect, "width", &field))
+      output->width = json_object_get_int(field);
+    if (json_object_object_get_ex(rect, "height", &field))
+      output->height = json_object_get_int(field);
+    output->scale = json_object_object_get_ex(element, "scale", &scale)
+                        ? json_object_get_double(scale)
+                        : 1;
+    if (json_object_object_get_ex(element, "focused", &focused) &&
+        json_object_get_boolean(focused))
+      registry_copy(registry->output, output->name, QUERY_NAME);
+  }
+
+  json_object_put(obj);
+  return true;
+}
+
+/* takes the focused workspace from a GET_WORKSPACES reply */
+bool registry_workspaces(struct registry *registry, const char *payload,
+                         size_t size) {
+  json_object *obj = registry_parse(payload, size);
+  if (obj == NULL)
+    return false;
+
+  int array_len = json_object_array_length(obj);
+  for (int i = 0; i < array_len; i++) {
+    json_object *element = json_object_array_get_idx(obj, i);
+    json_object *focused, *name, *output;
+
+    if (json_object_object_get_ex(element, "focused", &focused) &&
+        json_object_get_boolean(focused) &&
+        json_object_object_get_ex(element, "name", &name) &&
+        json_object_object_get_ex(element, "output", &output))
+      registry_focus(registry, json_object_get_string(name),
+                     json_object_get_string(output));
+  }
+
+  json_object_put(obj);
+  return true;
+}
+
+static void registry_walk(json_object *node, const char *workspace,
+                          const char *output, bool floating,
+                          struct registry_window *windows, int max,
+                          int *count) {
+  json_object *type, *name, *field;
+  if (!json_object_object_get_ex(node, "type", &type))
+    return;
+  const char *kind = json_object_get_string(type);
+  const char *title = json_object_object_get_ex(node, "name", &name) &&
+                              json_object_is_type(name, json_type_string)
+                          ? json_object_get_string(name)
+                          : NULL;
+
+  if (!strcmp(kind, "output"))
+    output = title;
+  else if (!strcmp(kind, "workspace"))
+    workspace = title;
+
+  if (json_object_object_get_ex(node, "visible", &field) &&
+      json_object_get_boolean(field) && title &&
+      strcmp("Sway Expose", title) && *count < max) {
+    struct registry_window *window = &windows[(*count)++];
+    json_object *rect;
+    memset(window, 0, sizeof(*window));
+    if (json_object_object_get_ex(node, "id", &field))
+      window->node = json_object_get_int(field);
+    if (json_object_object_get_ex(node, "rect", &rect)) {
+      if (json_object_object_get_ex(rect, "x", &field))
+        window->xcr = json_object_get_int(field);
+      if (json_object_object_get_ex(rect, "y", &field))
+        window->ycr = json_object_get_int(field);
+      if (json_object_object_get_ex(rect, "width", &field))
+        window->width = json_object_get_int(field);
+      if (json_object_object_get_ex(rect, "height", &field))
+        window->height = json_object_get_int(field);
+    }
+    registry_copy(window->title, title, ARENA_TITLE);
+    registry_copy(window->workspace, workspace ? workspace : "", QUERY_NAME);
+    registry_copy(window->output, output ? output : "", QUERY_NAME);
+    window->floating = floating;
+  }
+
+  const char *children[] = {"nodes", "floating_nodes"};
+  for (int i = 0; i < 2; i++) {
+    json_object *list;
+    if (!json_object_object_get_ex(node, children[i], &list))
+      continue;
+    int list_len = json_object_array_length(list);
+    for (int j = 0; j < list_len; j++)
+      registry_walk(json_object_array_get_idx(list, j), workspace, output,
+                    floating || i == 1, windows, max, count);
+  }
+}
+
+/* the windows sway currently shows, out of a GET_TREE reply; only views
+ * carry the visible flag, and hidden ones cannot be captured anyway */
+int registry_tree(const char *payload, size_t size,
+                  struct registry_window *windows, int max) {
+  json_tokener *tok = json_tokener_new_ex(JSON_MAX_DEPTH);
+  if (tok == NULL)
+    return -1;
+  json_object *obj = json_tokener_parse_ex(tok, payload, size);
+  enum json_tokener_error err = json_tokener_get_error(tok);
+  json_tokener_free(tok);
+  if (obj == NULL || err != json_tokener_success) {
+    json_object_put(obj);
+    return -1;
+  }
+
+  int count = 0;
+  registry_walk(obj, NULL, NULL, false, windows, max, &count);
+
+  json_object_put(obj);
+  return count;
+}
@@ -0,0 +1,48 @@
+#ifndef EXPOSWAY_REGISTRY_H
+#define EXPOSWAY_REGISTRY_H
+
+#include "query.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* what the arena does not know: the outputs, and for each window slot the
+ * workspace that was focused when the window last gained focus */
+struct registry {
+  struct registry_entry {
+    char workspace[QUERY_NAME];
+    char output[QUERY_NAME];
+  } entries[ARENA_SLOTS];
+
+  struct query_output outputs[QUERY_OUTPUTS];
+  int output_count;
+
+  char workspace[QUERY_NAME];
+  char output[QUERY_NAME];
+};
+
+/* a window as found in the layout tree */
+struct registry_window {
+  int node;
+  int xcr, ycr, width, height;
+  char title[ARENA_TITLE];
+  char workspace[QUERY_NAME];
+  char output[QUERY_NAME];
+  bool floating;
+};
+
+void registry_focus(struct registry *registry, const char *workspace,
+                    const char *output);
+void registry_place(struct registry *registry, int slot);
+void registry_assign(struct registry *registry, int slot,
+                     const char *workspace, const char *output);
+void registry_forget(struct registry *registry, int slot);
+const char *registry_locate(struct registry *registry, int xcr, int ycr,
+                            int width, int height);
+bool registry_outputs(struct registry *registry, const char *payload,
+                      size_t size);
+bool registry_workspaces(struct registry *registry, const char *payload,
+                         size_t size);
+int registry_tree(const char *payload, size_t size,
+                  struct registry_window *windows, int max);
+
+#endif
@@ -0,0 +1,467 @@
+#include "render.h"
+#include "arena.h"
+#include "codec.h"
+#include <pango/pangocairo.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+double render_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static const cairo_user_data_key_t snapshot_pixels;
+
+#define SNAPSHOT_RETRIES 8  /* reads of a snapshot being rewritten */
+#define SNAPSHOT_SIDE 32767 /* the largest image cairo takes */
+
+/* the smallest level of the snapshot at offset still at least as wide as
+ * what gets painted, copied out of the arena or decoded into pixels the
+ * surface owns; the daemon may be rewriting it meanwhile, so the header is
+ * read once and nothing in it is trusted past the mapping */
+static cairo_surface_t *_level(struct client_state *state, uint64_t offset,
+                               double width) {
+  struct snapshot_header header;
+  if (!offset || offset + sizeof(header) > state->arena_size)
+    return NULL;
+  memcpy(&header, state->arena + offset, sizeof(header));
+  if (header.magic != SNAPSHOT_MAGIC ||
+      (header.format != SNAPSHOT_ARGB32 && header.format != SNAPSHOT_QOI) ||
+      header.levels < 1 || header.levels > SNAPSHOT_LEVELS)
+    return NULL;
+
+  int pick = 0;
+  while (pick + 1 < (int)header.levels &&
+         header.level[pick + 1].width >= width)
+    pick++;
+
+  const struct snapshot_level *level = &header.level[pick];
+  if (level->width < 1 || level->width > SNAPSHOT_SIDE || level->height < 1 ||
+      level->height > SNAPSHOT_SIDE ||
+      level->stride != (uint32_t)cairo_format_stride_for_width(
+                           CAIRO_FORMAT_ARGB32, level->width) ||
+      offset + level->offset + (uint64_t)level->size > state->arena_size)
+    return NULL;
+
+  const unsigned char *src = state->arena + offset + level->offset;
+  size_t size = (size_t)level->stride * level->height;
+  unsigned char *pixels = malloc(size);
+  if (!pixels)
+    return NULL;
+  bool read = header.format == SNAPSHOT_QOI
+                  ? codec_decode(src, level->size, pixels, level->width,
+                                 level->height, level->stride)
+                  : level->size >= size;
+  if (!read) {
+    free(pixels);
+    return NULL;
+  }
+  if (header.format == SNAPSHOT_ARGB32)
+    memcpy(pixels, src, size);
+
+  cairo_surface_t *surface = cairo_image_surface_create_for_data(
+      pixels, CAIRO_FORMAT_ARGB32, level->width, level->height, level->stride);
+  cairo_surface_set_user_data(surface, &snapshot_pixels, pixels, free);
+  return surface;
+}
+
+/* exposwayd goes on capturing while exposway runs, and may rewrite a
+ * snapshot in place, move it or hand its slot to another window; the level
+ * is read between two loads of the window's slot and kept only when the
+ * slot's sequence held and it still belongs to the window, else read again
+ * from wherever the slot points now */
+static cairo_surface_t *_snapshot(struct client_state *state, int n,
+                                  double width) {
+  const struct wl_window *window = &state->wl_window[n];
+  const struct arena_slot *slot =
+      &((const struct arena_header *)state->arena)->slots[window->slot];
+  for (int retries = 0; retries < SNAPSHOT_RETRIES; retries++) {
+    struct arena_slot before, after;
+    if (!arena_slot_load(slot, &before) || before.node != window->node)
+      return NULL;
+    cairo_surface_t *surface = _level(state, before.offset, width);
+    /* the copy is done before the sequence is looked at again */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (arena_slot_load(slot, &after) && after.sequence == before.sequence)
+      return surface;
+    if (surface)
+      cairo_surface_destroy(surface);
+  }
+  return NULL;
+}
+
+/* the level is scaled to the thumbnail's size in buffer pixels; it may
+ * be larger than the window's logical size, on scaled outputs or when no
+ * smaller one exists */
+static cairo_surface_t *_thumbnail(struct client_state *state, int n) {
+  struct wl_window *window = &state->wl_window[n];
+  int width = window->width * window->scale_factor + 0.5;
+  int height = window->height * window->scale_factor + 0.5;
+  if (width < 1 || height < 1)
+    return NULL;
+
+  cairo_surface_t *image = _snapshot(state, n, width);
+  ASSERT(image != NULL, "failed to create cairo image surface");
+  if (!image)
+    return NULL;
+
+  cairo_surface_t *thumbnail =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  if (cairo_surface_status(thumbnail) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(thumbnail);
+    cairo_surface_destroy(image);
+    return NULL;
+  }
+  cairo_t *cr = cairo_create(thumbnail);
+  cairo_scale(cr, (double)width / cairo_image_surface_get_width(image),
+              (double)height / cairo_image_surface_get_height(image));
+  cairo_set_source_surface(cr, image, 0, 0);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(image);
+  return thumbnail;
+}
+
+/* each title shaped once, ellipsized to its thumbnail's width so long ones
+ * stay clear of the neighbours, and rasterized into an alpha mask */
+static void _titles(struct client_state *state) {
+  double start = render_now();
+  PangoFontDescription *font_description = pango_font_description_new();
+  pango_font_description_set_family(font_description, "monospace");
+  pango_font_description_set_weight(font_description, PANGO_WEIGHT_NORMAL);
+  pango_font_description_set_absolute_size(font_description,
+                                           TITLE_SZE * PANGO_SCALE);
+  PangoContext *context =
+      pango_font_map_create_context(pango_cairo_font_map_get_default());
+  PangoLayout *layout = pango_layout_new(context);
+  pango_layout_set_font_description(layout, font_description);
+  pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
+
+  for (int n = 0; n < state->window_count; n++) {
+    const struct wl_window *window = &state->wl_window[n];
+    pango_layout_set_width(layout, window->width * window->scale_factor *
+                                       PANGO_SCALE);
+    pango_layout_set_text(layout, window->title, -1);
+
+    PangoRectangle extends;
+    pango_layout_get_pixel_extents(layout, NULL, &extends);
+    if (extends.width < 1 || extends.height < 1)
+      continue;
+
+    cairo_surface_t *mask = cairo_image_surface_create(
+        CAIRO_FORMAT_A8, extends.width, extends.height);
+    if (cairo_surface_status(mask) != CAIRO_STATUS_SUCCESS) {
+      cairo_surface_destroy(mask);
+      continue;
+    }
+    cairo_t *cr = cairo_create(mask);
+    cairo_move_to(cr, -extends.x, -extends.y);
+    pango_cairo_show_layout(cr, layout);
+    cairo_destroy(cr);
+
+    state->titles[n] = mask;
+    state->title_bytes += (size_t)cairo_image_surface_get_stride(mask) *
+                          extends.height;
+  }
+
+  g_object_unref(layout);
+  g_object_unref(context);
+  pango_font_description_free(font_description);
+  state->stats.title += render_now() - start;
+}
+
+static bool _loader(struct client_state *state) {
+  state->thumbnails = calloc(state->window_count ? state->window_count : 1,
+                             sizeof(*state->thumbnails));
+  if (!state->thumbnails)
+    return false;
+  state->loader.next = 0;
+  state->loader.loading = true;
+  state->loader.start = render_now();
+  return true;
+}
+
+static void *_load(void *data) {
+  struct client_state *state = data;
+  int n;
+  while ((n = __atomic_fetch_add(&state->loader.next, 1, __ATOMIC_RELAXED)) <
+         state->window_count)
+    state->thumbnails[n] = _thumbnail(state, n);
+  return NULL;
+}
+
+/* decodes and scales the snapshots on threads, one per core unless told
+ * otherwise, while exposway goes on setting its window up; windows are
+ * handed out one at a time, so a few large ones do not hold the rest up */
+bool render_cache_start(struct client_state *state, int threads) {
+  if (!state->thumbnails && !_loader(state))
+    return false;
+  if (!state->loader.loading || state->loader.count)
+    return true;
+
+  if (threads < 1)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1)
+    threads = 1;
+  if (threads > state->window_count)
+    threads = state->window_count;
+  if (threads > RENDER_THREADS)
+    threads = RENDER_THREADS;
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&state->loader.threads[i], NULL, _load, state))
+      break;
+    state->loader.count++;
+  }
+  return true;
+}
+
+/* waits for the thumbnails, making whatever is left on this thread; the
+ * surfaces stay until render_fini */
+bool render_cache(struct client_state *state) {
+  if (!state->thumbnails && !_loader(state))
+    return false;
+  if (!state->loader.loading)
+    return true;
+
+  /* pango stays on this thread, shaping while the thumbnails load */
+  state->titles = calloc(state->window_count ? state->window_count : 1,
+                         sizeof(*state->titles));
+  double titled = render_now();
+  if (state->titles)
+    _titles(state);
+  titled = render_now() - titled;
+  _load(state);
+  for (int i = 0; i < state->loader.count; i++)
+    pthread_join(state->loader.threads[i], NULL);
+  state->loader.count = 0;
+
+  for (int n = 0; n < state->window_count; n++)
+    if (state->thumbnails[n])
+      state->thumbnail_bytes +=
+          (size_t)cairo_image_surface_get_stride(state->thumbnails[n]) *
+          cairo_image_surface_get_height(state->thumbnails[n]);
+  state->stats.decode += render_now() - state->loader.start - titled;
+  state->loader.loading = false;
+  return true;
+}
+
+static void _plot(struct client_state *state, int n) {
+  double start = render_now();
+  if (state->thumbnails[n]) {
+    cairo_set_source_surface(state->cr, state->thumbnails[n],
+                             state->wl_window[n].xcr, state->wl_window[n].ycr);
+    cairo_paint(state->cr);
+  }
+  state->stats.paint += render_now() - start;
+}
+
+/* the focus frame, stroked around the thumbnail on top of the base */
+static void _frame(struct client_state *state, int n) {
+  struct wl_window *window = &state->wl_window[n];
+  cairo_save(state->cr);
+  cairo_translate(state->cr, window->xcr, window->ycr);
+  cairo_scale(state->cr, window->scale_factor, window->scale_factor);
+
+  cairo_set_source_rgb(state->cr, FRAME_CLR);
+  cairo_set_line_width(state->cr, FRAME_WDH / window->scale_factor);
+  cairo_rectangle(state->cr, -FRAME_WDH / window->scale_factor,
+                  -FRAME_WDH / window->scale_factor,
+                  window->width + FRAME_WDH * 2 / window->scale_factor,
+                  window->height + FRAME_WDH * 2 / window->scale_factor);
+  cairo_stroke(state->cr);
+
+  cairo_restore(state->cr);
+}
+
+/* the four strips of the output the frame of window n may touch, clipped
+ * to the output; the stroke reaches FRAME_WDH / 2 to FRAME_WDH * 3 / 2
+ * outside of the thumbnail, antialiasing one pixel further */
+static int _edges(struct client_state *state, int n,
+                  struct render_rect *edges) {
+  const struct wl_window *window = &state->wl_window[n];
+  int pad = FRAME_WDH * 3 / 2 + 2;
+  int left = window->xcr, top = window->ycr;
+  int right = window->xcr + (int)(window->width * window->scale_factor);
+  int bottom = window->ycr + (int)(window->height * window->scale_factor);
+
+  struct render_rect strips[4] = {
+      {left - pad, top - pad, right - left + pad * 2, pad},
+      {left - pad, bottom, right - left + pad * 2, pad},
+      {left - pad, top, pad, bottom - top},
+      {right, top, pad, bottom - top},
+  };
+  int count = 0;
+  for (int i = 0; i < 4; i++) {
+    struct render_rect edge = strips[i];
+    if (edge.x < 0) {
+      edge.width += edge.x;
+      edge.x = 0;
+    }
+    if (edge.y < 0) {
+      edge.height += edge.y;
+      edge.y = 0;
+    }
+    if (edge.x + edge.width > state->display_width)
+      edge.width = state->display_width - edge.x;
+    if (edge.y + edge.height > state->display_height)
+      edge.height = state->display_height - edge.y;
+    if (edge.width > 0 && edge.height > 0)
+      edges[count++] = edge;
+  }
+  return count;
+}
+
+static void _copy(struct client_state *state, unsigned char *data, int stride,
+                  const struct render_rect *rect) {
+  for (int y = rect->y; y < rect->y + rect->height; y++)
+    memcpy(data + (size_t)y * stride + rect->x * 4,
+           state->base + (size_t)y * state->base_stride + rect->x * 4,
+           rect->width * 4);
+}
+
+/* centred under the thumbnail, a quarter of its height below it */
+static void _title(struct client_state *state, int n) {
+  double start = render_now();
+  const struct wl_window *window = &state->wl_window[n];
+  cairo_surface_t *mask = state->titles[n];
+  if (mask) {
+    int width = cairo_image_surface_get_width(mask);
+    int height = cairo_image_surface_get_height(mask);
+    cairo_set_source_rgb(state->cr, TITLE_CLR);
+    cairo_mask_surface(
+        state->cr, mask,
+        (int)(window->xcr + (window->width * window->scale_factor - width) / 2),
+        (int)(window->ycr + window->height * window->scale_factor +
+              height / 4));
+  }
+  state->stats.title += render_now() - start;
+}
+
+/* every thumbnail and title, drawn once into the base */
+static bool _base(struct client_state *state) {
+  if (!render_cache(state))
+    return false;
+  state->base_stride =
+      cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, state->display_width);
+  state->base = calloc(state->display_height, state->base_stride);
+  if (!state->base)
+    return false;
+
+  state->surface = cairo_image_surface_create_for_data(
+      state->base, CAIRO_FORMAT_ARGB32, state->display_width,
+      state->display_height, state->base_stride);
+  ASSERT(state->surface != NULL, "cairo_image_surface create failed");
+  state->cr = cairo_create(state->surface);
+
+  for (int n = 0; n < state->window_count; n++) {
+    _plot(state, n);
+    _title(state, n);
+  }
+
+  cairo_destroy(state->cr);
+  cairo_surface_destroy(state->surface);
+  return true;
+}
+
+/* brings data, display_width by display_height ARGB32 pixels last drawn
+ * with the frame around window *framed (or RENDER_BLANK), up to date: only
+ * the edges of the frames that moved are copied from the base and
+ * redrawn */
+bool render_update(struct client_state *state, unsigned char *data,
+                   int stride, int *framed) {
+  if (!state->base && !_base(state))
+    return false;
+
+  double start = render_now();
+  int target = state->frame_draw && state->window_focused >= 0 &&
+                       state->window_focused < state->window_count
+                   ? state->window_focused
+                   : -1;
+  struct render_rect edges[4];
+  if (*framed == RENDER_BLANK) {
+    struct render_rect all = {0, 0, state->display_width,
+                              state->display_height};
+    _copy(state, data, stride, &all);
+  } else if (*framed >= 0 && *framed != target) {
+    for (int i = 0, count = _edges(state, *framed, edges); i < count; i++)
+      _copy(state, data, stride, &edges[i]);
+  }
+
+  if (target >= 0 && target != *framed) {
+    state->surface = cairo_image_surface_create_for_data(
+        data, CAIRO_FORMAT_ARGB32, state->display_width,
+        state->display_height, stride);
+    ASSERT(state->surface != NULL, "cairo_image_surface create failed");
+    state->cr = cairo_create(state->surface);
+    _frame(state, target);
+    cairo_destroy(state->cr);
+    cairo_surface_destroy(state->surface);
+  }
+
+  *framed = target;
+  state->stats.paint += render_now() - start;
+  state->stats.frames++;
+  return true;
+}
+
+/* what changed on screen going from a buffer framed around from to one
+ * framed around to, in buffer coordinates; returns the rectangle count */
+int render_damage(struct client_state *state, int from, int to,
+                  struct render_rect *damage) {
+  if (from == RENDER_BLANK) {
+    damage[0] = (struct render_rect){0, 0, state->display_width,
+                                     state->display_height};
+    return 1;
+  }
+  if (from == to)
+    return 0;
+
+  int count = 0;
+  if (from >= 0)
+    count += _edges(state, from, damage + count);
+  if (to >= 0)
+    count += _edges(state, to, damage + count);
+  return count;
+}
+
+/* a full frame drawn offscreen and written out as a PNG, opaque like the
+ * XRGB buffer exposway shows */
+bool render_png(struct client_state *state, const char *path) {
+  int stride =
+      cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, state->display_width);
+  unsigned char *data = calloc(state->display_height, stride);
+  if (!data)
+    return false;
+
+  int framed = RENDER_BLANK;
+  bool rendered = render_update(state, data, stride, &framed);
+  cairo_surface_t *surface = cairo_image_surface_create_for_data(
+      data, CAIRO_FORMAT_RGB24, state->display_width, state->display_height,
+      stride);
+  bool written = rendered && cairo_surface_write_to_png(surface, path) ==
+                                 CAIRO_STATUS_SUCCESS;
+  cairo_surface_destroy(surface);
+  free(data);
+  return written;
+}
+
+void render_fini(struct client_state *state) {
+  if (state->loader.loading)
+    render_cache(state);
+  for (int n = 0; state->thumbnails && n < state->window_count; n++)
+    if (state->thumbnails[n])
+      cairo_surface_destroy(state->thumbnails[n]);
+  for (int n = 0; state->titles && n < state->window_count; n++)
+    if (state->titles[n])
+      cairo_surface_destroy(state->titles[n]);
+  free(state->thumbnails);
+  free(state->titles);
+  free(state->base);
+  state->thumbnails = NULL;
+  state->titles = NULL;
+  state->thumbnail_bytes = state->title_bytes = 0;
+  state->base = NULL;
+}
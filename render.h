@@ -0,0 +1,123 @@
+#ifndef EXPOSWAY_RENDER_H
+#define EXPOSWAY_RENDER_H
+
+#include "layout.h"
+#include <cairo/cairo.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define FRAME_CLR 16, 102, 130 /* frame color */
+#define FRAME_WDH 1.6          /* frame width */
+#define FRAME_SEP 2            /* frame seperation */
+#define TITLE_CLR 1, 1, 1      /* title font color */
+#define TITLE_SZE 12           /* title font size */
+#define SHM_BUFFERS 3          /* frames the compositor may hold at once */
+#define RENDER_THREADS 16      /* most threads making thumbnails */
+#define ASSERT(condition, message)                                             \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "Assertion failed: (%s), function %s, line %d.\n",       \
+              #condition, __FUNCTION__, __LINE__);                             \
+      fprintf(stderr, "Error message: %s.\n", message);                        \
+    }                                                                          \
+  } while (0)
+
+#define RENDER_BLANK -2 /* a buffer holding nothing drawn yet */
+#define RENDER_DAMAGE 8 /* rectangles of a focus change, the edges of two */
+
+struct render_rect {
+  int x, y, width, height;
+};
+
+/* microseconds spent in each stage of drawing, summed over frames */
+struct render_stats {
+  double decode; /* snapshots decoded and scaled into thumbnails */
+  double paint;  /* thumbnails and the focus frame */
+  double title; /* shaped once into masks, then composited */
+  double commit; /* getting the buffer to draw in and handing it over */
+  unsigned long frames;
+};
+
+/* the Wayland objects are only ever touched by expose.c, the rest of the
+ * state is what a frame is drawn from */
+struct client_state {
+  struct wl_display *wl_display;
+  struct wl_registry *wl_registry;
+  struct wl_shm *wl_shm;
+  struct wl_compositor *wl_compositor;
+  struct wl_surface *wl_surface;
+  struct wl_seat *wl_seat;
+  struct wl_window *wl_window;
+
+  struct xdg_wm_base *xdg_wm_base;
+  struct xdg_surface *xdg_surface;
+  struct xdg_toplevel *xdg_toplevel;
+
+  struct xkb_context *xkb_context;
+  struct xkb_state *xkb_state;
+  int32_t xkb_delay;
+
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  /* frames are drawn into buffers carved out of one shm pool, mapped once;
+   * a buffer is busy from its attach until the compositor releases it */
+  struct shm_buffer {
+    struct wl_buffer *wl_buffer;
+    unsigned char *data;
+    bool busy;
+    int framed; /* window whose frame the buffer shows, -1 for none */
+  } shm_buffers[SHM_BUFFERS];
+  unsigned char *shm_data;
+  size_t shm_size;
+  int shown; /* framed window of the buffer last committed */
+
+  /* each snapshot decoded and scaled to its thumbnail's size once, NULL
+   * where there is none */
+  cairo_surface_t **thumbnails;
+  size_t thumbnail_bytes;
+  cairo_surface_t **titles; /* alpha masks, NULL for an empty title */
+  size_t title_bytes;
+  struct render_loader {
+    pthread_t threads[RENDER_THREADS];
+    int count;
+    int next; /* window the next idle thread takes */
+    bool loading;
+    double start;
+  } loader;
+
+  /* the thumbnails and titles, drawn once; buffers are brought up to date
+   * by copying from it what the focus frame covered */
+  unsigned char *base;
+  int base_stride;
+
+  unsigned char *arena;
+  size_t arena_size;
+
+  int display_width, display_height;
+  int window_count;
+  int window_focused;
+  bool frame_draw;
+  bool focus_changing;
+  bool focus_changed;
+  bool exit;
+  clock_t focus_changed_time;
+
+  struct render_stats stats;
+};
+
+double render_now(void);
+bool render_cache_start(struct client_state *state, int threads);
+bool render_cache(struct client_state *state);
+bool render_update(struct client_state *state, unsigned char *data,
+                   int stride, int *framed);
+int render_damage(struct client_state *state, int from, int to,
+                  struct render_rect *damage);
+bool render_png(struct client_state *state, const char *path);
+void render_fini(struct client_state *state);
+
+#endif
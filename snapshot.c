@@ -0,0 +1,153 @@
+#include "snapshot.h"
+#include "codec.h"
+#include "tile.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t snapshot_round(size_t size) {
+  return (size + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+/* fills in the geometry of every level; returns the bytes needed */
+static size_t snapshot_layout(struct snapshot_header *header, int width,
+                              int height) {
+  memset(header, 0, sizeof(*header));
+  header->magic = SNAPSHOT_MAGIC;
+  header->format = SNAPSHOT_ARGB32;
+  header->width = width;
+  header->height = height;
+  header->stride = width * 4;
+
+  size_t size = snapshot_round(sizeof(*header));
+  for (int i = 0; i < SNAPSHOT_LEVELS && width > 0 && height > 0; i++) {
+    header->level[i] = (struct snapshot_level){
+        .offset = size,
+        .width = width,
+        .height = height,
+        .stride = width * 4,
+        .size = width * 4 * height,
+    };
+    header->levels++;
+    size += snapshot_round((size_t)width * 4 * height);
+    width /= 2;
+    height /= 2;
+  }
+
+  header->tile_columns = tile_columns(header->width);
+  header->tile_rows = tile_rows(header->height);
+  header->tiles = size;
+  size += snapshot_round(sizeof(struct snapshot_tile) * header->tile_columns *
+                         header->tile_rows);
+  return size;
+}
+
+/* per-channel mean of two pixels, rounding down */
+static inline uint32_t snapshot_mean(uint32_t a, uint32_t b) {
+  return (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1);
+}
+
+/* 2x2 box filter; a trailing odd row or column is dropped */
+static void snapshot_halve(const unsigned char *src, int src_stride,
+                           unsigned char *dest, int width, int height,
+                           int dest_stride) {
+  for (int y = 0; y < height; y++) {
+    const uint32_t *upper =
+        (const uint32_t *)(src + (size_t)y * 2 * src_stride);
+    const uint32_t *lower =
+        (const uint32_t *)(src + ((size_t)y * 2 + 1) * src_stride);
+    uint32_t *row = (uint32_t *)(dest + (size_t)y * dest_stride);
+    for (int x = 0; x < width; x++)
+      row[x] = snapshot_mean(snapshot_mean(upper[2 * x], upper[2 * x + 1]),
+                             snapshot_mean(lower[2 * x], lower[2 * x + 1]));
+  }
+}
+
+/* lays the capture out as a complete snapshot in *buffer, growing it as
+ * needed, with hashes from tile_hash; returns its size, 0 when out of
+ * memory */
+size_t snapshot_build(unsigned char **buffer, size_t *capacity,
+                      const unsigned char *data, int width, int height,
+                      int stride, bool invert, const uint32_t *hashes) {
+  struct snapshot_header header;
+  size_t size = snapshot_layout(&header, width, height);
+
+  if (size > *capacity) {
+    unsigned char *grown = realloc(*buffer, size);
+    if (!grown)
+      return 0;
+    *buffer = grown;
+    *capacity = size;
+  }
+
+  memcpy(*buffer, &header, sizeof(header));
+  unsigned char *pixels = *buffer + header.level[0].offset;
+  for (int y = 0; y < height; y++)
+    memcpy(pixels + (size_t)y * header.stride,
+           data + (size_t)(invert ? height - 1 - y : y) * stride,
+           header.stride);
+
+  for (uint32_t i = 1; i < header.levels; i++) {
+    const struct snapshot_level *src = &header.level[i - 1];
+    const struct snapshot_level *dest = &header.level[i];
+    snapshot_halve(*buffer + src->offset, src->stride, *buffer + dest->offset,
+                   dest->width, dest->height, dest->stride);
+  }
+
+  struct snapshot_tile *tiles =
+      (struct snapshot_tile *)(*buffer + header.tiles);
+  for (uint32_t i = 0; i < header.tile_columns * header.tile_rows; i++)
+    tiles[i] = (struct snapshot_tile){.hash = hashes[i]};
+
+  return size;
+}
+
+/* re-lays a snapshot out of snapshot_build in format, into *buffer; returns
+ * its size, 0 when out of memory or when it would not save a quarter of the
+ * raw size, the raw snapshot being the better one to keep then */
+size_t snapshot_encode(unsigned char **buffer, size_t *capacity,
+                       const unsigned char *snapshot,
+                       enum snapshot_format format) {
+  if (format != SNAPSHOT_QOI)
+    return 0;
+
+  const struct snapshot_header *raw =
+      (const struct snapshot_header *)snapshot;
+  size_t raw_size = raw->tiles + snapshot_round(sizeof(struct snapshot_tile) *
+                                                raw->tile_columns *
+                                                raw->tile_rows);
+  size_t limit = raw_size / 4 * 3;
+
+  if (limit > *capacity) {
+    unsigned char *grown = realloc(*buffer, limit);
+    if (!grown)
+      return 0;
+    *buffer = grown;
+    *capacity = limit;
+  }
+
+  struct snapshot_header *header = (struct snapshot_header *)*buffer;
+  memcpy(header, raw, sizeof(*header));
+  header->format = format;
+
+  size_t size = snapshot_round(sizeof(*header));
+  for (uint32_t i = 0; i < raw->levels; i++) {
+    const struct snapshot_level *level = &raw->level[i];
+    if (size >= limit)
+      return 0;
+    size_t encoded =
+        codec_encode(snapshot + level->offset, level->width, level->height,
+                     level->stride, *buffer + size, limit - size);
+    if (!encoded)
+      return 0;
+    header->level[i].offset = size;
+    header->level[i].size = encoded;
+    size += snapshot_round(encoded);
+  }
+
+  size_t tiles = raw_size - raw->tiles;
+  if (size + tiles > limit)
+    return 0;
+  memcpy(*buffer + size, snapshot + raw->tiles, tiles);
+  header->tiles = size;
+  return size + tiles;
+}
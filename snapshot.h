@@ -0,0 +1,60 @@
+#ifndef EXPOSWAY_SNAPSHOT_H
+#define EXPOSWAY_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC 0x50584553 /* "SEXP" */
+#define SNAPSHOT_LEVELS 4 /* full size, then halved down to an eighth */
+#define SNAPSHOT_ALIGN 64
+
+enum snapshot_format {
+  SNAPSHOT_ARGB32 = 0, /* premultiplied, native-endian 0xAARRGGBB words */
+  SNAPSHOT_QOI = 1,    /* the same words, each level through codec_encode */
+};
+
+struct snapshot_level {
+  uint32_t offset; /* of the first row, from the start of the header */
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride; /* once decoded */
+  uint32_t size;   /* bytes stored */
+};
+
+/* a TILE_SIZE square of level 0, and the matching squares of the other
+ * levels; generation is the snapshot's when the tile last changed */
+struct snapshot_tile {
+  uint32_t hash;
+  uint32_t reserved;
+  uint64_t generation;
+};
+
+/* a snapshot is this header followed by each level's height rows of stride
+ * bytes, level 0 being the full capture and every further level half the
+ * one before, and then the tile table; levels start SNAPSHOT_ALIGN-aligned,
+ * letting clients hand the mapping to cairo without a copy, unless the
+ * format says they were encoded */
+struct snapshot_header {
+  uint32_t magic;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t levels;
+  uint64_t generation;
+  struct snapshot_level level[SNAPSHOT_LEVELS];
+  uint32_t tile_columns;
+  uint32_t tile_rows;
+  uint32_t tiles; /* offset of the tile table, from the start of the header */
+  uint32_t dirty; /* tiles the last capture changed */
+};
+
+size_t snapshot_build(unsigned char **buffer, size_t *capacity,
+                      const unsigned char *data, int width, int height,
+                      int stride, bool invert, const uint32_t *hashes);
+size_t snapshot_encode(unsigned char **buffer, size_t *capacity,
+                       const unsigned char *snapshot,
+                       enum snapshot_format format);
+
+#endif
@@ -0,0 +1,93 @@
+#include "tile.h"
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+/* rows are walked top to bottom and each one feeds every tile it crosses,
+ * so the per-tile chains are independent and overlap in the pipeline */
+#define TILE_WALK(update)                                                      \
+  do {                                                                         \
+    int columns = tile_columns(width);                                         \
+    memset(hashes, 0, sizeof(*hashes) * columns * tile_rows(height));          \
+    for (int y = 0; y < height; y++) {                                         \
+      const unsigned char *row =                                               \
+          data + (size_t)(invert ? height - 1 - y : y) * stride;               \
+      uint32_t *chain = hashes + (size_t)(y / TILE_SIZE) * columns;            \
+      for (int x = 0; x < columns; x++) {                                      \
+        const unsigned char *p = row + (size_t)x * TILE_SIZE * 4;              \
+        size_t len = (size_t)(width - x * TILE_SIZE < TILE_SIZE                \
+                                  ? width - x * TILE_SIZE                      \
+                                  : TILE_SIZE) *                               \
+                     4;                                                        \
+        update;                                                                \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2"))) static void
+tile_hash_crc(const unsigned char *data, int width, int height, int stride,
+              bool invert, uint32_t *hashes) {
+  TILE_WALK({
+    uint32_t crc = chain[x];
+#if defined(__x86_64__)
+    for (; len >= 8; p += 8, len -= 8) {
+      uint64_t word;
+      memcpy(&word, p, 8);
+      crc = _mm_crc32_u64(crc, word);
+    }
+#endif
+    for (; len >= 4; p += 4, len -= 4) {
+      uint32_t word;
+      memcpy(&word, p, 4);
+      crc = _mm_crc32_u32(crc, word);
+    }
+    chain[x] = crc;
+  });
+}
+#endif
+
+static void tile_hash_mix(const unsigned char *data, int width, int height,
+                          int stride, bool invert, uint32_t *hashes) {
+  TILE_WALK({
+    uint64_t h = chain[x];
+    for (; len >= 8; p += 8, len -= 8) {
+      uint64_t word;
+      memcpy(&word, p, 8);
+      h = (h ^ word) * 0x9E3779B97F4A7C15;
+      h ^= h >> 29;
+    }
+    if (len) {
+      uint32_t word;
+      memcpy(&word, p, 4);
+      h = (h ^ word) * 0x9E3779B97F4A7C15;
+      h ^= h >> 29;
+    }
+    chain[x] = h ^ h >> 32;
+  });
+}
+
+/* picked once, before main, so the workers hashing at the same time only
+ * ever read it */
+static void (*tile_hasher_fn)(const unsigned char *data, int width,
+                              int height, int stride, bool invert,
+                              uint32_t *hashes) = tile_hash_mix;
+
+__attribute__((constructor)) static void tile_dispatch(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+    tile_hasher_fn = tile_hash_crc;
+#endif
+}
+
+void tile_hash(const unsigned char *data, int width, int height, int stride,
+               bool invert, uint32_t *hashes) {
+  tile_hasher_fn(data, width, height, stride, invert, hashes);
+}
+
+const char *tile_hasher(void) {
+  return tile_hasher_fn == tile_hash_mix ? "portable" : "crc32c";
+}
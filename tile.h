@@ -0,0 +1,24 @@
+#ifndef EXPOSWAY_TILE_H
+#define EXPOSWAY_TILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* pixels a side; a multiple of 1 << (SNAPSHOT_LEVELS - 1) */
+#define TILE_SIZE 64
+
+static inline int tile_columns(int width) {
+  return (width + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+static inline int tile_rows(int height) {
+  return (height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+/* one hash per tile, row by row, of ARGB32 rows laid out bottom-up when
+ * invert is set */
+void tile_hash(const unsigned char *data, int width, int height, int stride,
+               bool invert, uint32_t *hashes);
+const char *tile_hasher(void);
+
+#endif